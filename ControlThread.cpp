@@ -2,77 +2,440 @@
 #include <iostream>
 #include <mutex>
 #include <thread>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <climits>
 #include <condition_variable>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <tuple>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "mainwindow.h"
 #include "ControlThread.hpp"
 
 using namespace std;
 
-ControlThread::ControlThread(unsigned long tcks, MainWindow *pWind):
-    ticks(tcks), taskCount(0), beginnable(false), mainWindow(pWind)
+static const uint64_t ARRIVED_ONE = 1ULL << 32;
+static const uint64_t EXPECTED_MASK = ARRIVED_ONE - 1;
+
+//lay out the combining tree - leaves first, each level above BARRIER_FANIN
+//times narrower, the root last
+ControlThread::ControlThread(unsigned long tcks, MainWindow *pWind,
+    unsigned long members, SimulationEngine eng,
+    unsigned long workerThreads):
+    ticks(tcks), round(tcks), parked(0), blockedInTree(0),
+    memberCount(members > 0 ? members : 1),
+    nextWake(ULLONG_MAX), beginnable(false), mainWindow(pWind),
+    engine(eng), workerCount(workerThreads > 0 ? workerThreads : 1),
+    outstanding(0), epoch(0), stopping(false)
 {
-    QObject::connect(this, SIGNAL(updateCycles()),
-        pWind, SLOT(updateLCD()));
-    blockedInTree = 0;
+    vector<uint64_t> levelWidths;
+    uint64_t width = (members + BARRIER_FANIN - 1) / BARRIER_FANIN;
+    if (width == 0) {
+        width = 1;
+    }
+    levelWidths.push_back(width);
+    leafCount = width;
+    nodeCount = width;
+    while (width > 1) {
+        width = (width + BARRIER_FANIN - 1) / BARRIER_FANIN;
+        levelWidths.push_back(width);
+        nodeCount += width;
+    }
+    nodes = new BarrierNode[nodeCount];
+    uint64_t levelStart = 0;
+    for (uint64_t level = 0; level + 1 < levelWidths.size(); level++) {
+        const uint64_t parentStart = levelStart + levelWidths[level];
+        for (uint64_t i = 0; i < levelWidths[level]; i++) {
+            nodes[levelStart + i].parent =
+                parentStart + i / BARRIER_FANIN;
+        }
+        levelStart = parentStart;
+    }
 }
 
-void ControlThread::releaseToRun()
+ControlThread::~ControlThread()
 {
-	unique_lock<mutex> lck(runLock);
-	taskCountLock.lock();
-	signedInCount++;
-	if (signedInCount >= taskCount) {
-		taskCountLock.unlock();
-		lck.unlock();
-		run();
-		return;
-	}
-	taskCountLock.unlock();
-	go.wait(lck);
+    delete[] nodes;
+    for (auto worker: workers) {
+        delete worker;
+    }
 }
 
-void ControlThread::incrementTaskCount()
+long ControlThread::leafOf(const uint64_t& member) const
 {
-	unique_lock<mutex> lock(taskCountLock);
-	taskCount++;
+    return (member / BARRIER_FANIN) % leafCount;
 }
 
-void ControlThread::decrementTaskCount()
+//a node only joins its parent when it gains its first member - so new
+//members must join while a member of their leaf is still to arrive, or
+//while no tick is in progress
+void ControlThread::join(long node)
 {
-	unique_lock<mutex> lck(runLock);
-	unique_lock<mutex> lock(taskCountLock);
-	taskCount--;
-    lock.unlock();
-    lck.unlock();
-	if (signedInCount >= taskCount) {
-		run();
-	}
+    while (node >= 0) {
+        const uint64_t state = nodes[node].state.fetch_add(1);
+        if ((state & EXPECTED_MASK) > 0) {
+            return;
+        }
+        node = nodes[node].parent;
+    }
+}
+
+void ControlThread::leave(long node)
+{
+    while (node >= 0) {
+        uint64_t state = nodes[node].state.load();
+        uint64_t next;
+        uint64_t arrived;
+        uint64_t expected;
+        do {
+            arrived = state >> 32;
+            expected = (state & EXPECTED_MASK) - 1;
+            next = (arrived > 0 && arrived >= expected) ?
+                expected : state - 1;
+        } while (!nodes[node].state.compare_exchange_weak(state, next));
+        //the rest of the node had arrived - it is complete now
+        if (arrived > 0 && arrived >= expected) {
+            if (nodes[node].parent < 0) {
+                run();
+            } else {
+                arrive(nodes[node].parent);
+            }
+            return;
+        }
+        //an empty node drops out of its parent too
+        if (expected > 0) {
+            return;
+        }
+        node = nodes[node].parent;
+    }
+    //nobody left awake
+    skipAhead();
+}
+
+//the last arrival at a node resets it and carries on up the tree
+void ControlThread::arrive(long node)
+{
+    while (node >= 0) {
+        uint64_t state = nodes[node].state.load();
+        uint64_t next;
+        bool complete;
+        do {
+            complete = (state >> 32) + 1 >= (state & EXPECTED_MASK);
+            next = complete ? (state & EXPECTED_MASK) :
+                state + ARRIVED_ONE;
+        } while (!nodes[node].state.compare_exchange_weak(state, next));
+        if (!complete) {
+            return;
+        }
+        node = nodes[node].parent;
+    }
+    run();
+}
+
+//one line of a sysfs file, or -1 where the kernel does not say
+static long readTopology(const string& path)
+{
+    ifstream topologyFile(path);
+    long value = -1;
+    if (!(topologyFile >> value)) {
+        return -1;
+    }
+    return value;
+}
+
+//expand a cpulist such as 0-3,8-11
+static vector<int> parseCpuList(const string& list)
+{
+    vector<int> cpus;
+    stringstream ranges(list);
+    string range;
+    while (getline(ranges, range, ',')) {
+        const size_t dash = range.find('-');
+        const int first = stoi(range.substr(0, dash));
+        const int last = dash == string::npos ? first :
+            stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+//pin tile threads so each Mux subtree - a contiguous run of tiles -
+//lands on one NUMA node and, within it, one shared last-level cache
+void ControlThread::pinThreads()
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        cerr << "Could not read host CPUs - threads not pinned" << endl;
+        return;
+    }
+    vector<long> nodeOf(CPU_SETSIZE, 0);
+    for (long node = 0; ; node++) {
+        ifstream nodeList("/sys/devices/system/node/node" +
+            to_string(node) + "/cpulist");
+        string list;
+        if (!getline(nodeList, list)) {
+            break;
+        }
+        for (auto cpu: parseCpuList(list)) {
+            if (cpu < CPU_SETSIZE) {
+                nodeOf[cpu] = node;
+            }
+        }
+    }
+    vector<tuple<long, long, long, long, int> > order;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) {
+            continue;
+        }
+        const string base = "/sys/devices/system/cpu/cpu" +
+            to_string(cpu);
+        order.push_back(make_tuple(nodeOf[cpu],
+            readTopology(base + "/topology/physical_package_id"),
+            readTopology(base + "/cache/index3/id"),
+            readTopology(base + "/topology/core_id"), cpu));
+    }
+    sort(order.begin(), order.end());
+    cores.clear();
+    for (auto& core: order) {
+        cores.push_back(get<4>(core));
+    }
+    if (engine == ENGINE_EVENT) {
+        return;
+    }
+    //whole runs of tiles to a core, or a core each when there are more
+    placement.assign(memberCount, 0);
+    for (uint64_t i = 0; i < memberCount; i++) {
+        const uint64_t slot = memberCount >= cores.size() ?
+            i * cores.size() / memberCount : i;
+        placement[i] = cores[slot];
+        const auto& core = order[slot];
+        cout << "Tile " << i << " pinned to CPU " << placement[i];
+        cout << " (node " << get<0>(core) << ", package ";
+        cout << get<1>(core) << ", cache " << get<2>(core) << ")" << endl;
+    }
+}
+
+void ControlThread::pin(thread *host, const int& core)
+{
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(core, &mask);
+    const pthread_t handle = host ? host->native_handle() : pthread_self();
+    if (pthread_setaffinity_np(handle, sizeof(mask), &mask) != 0) {
+        cerr << "Could not pin a thread to CPU " << core << endl;
+    }
+}
+
+//spin briefly on a counter, then sleep on it
+void ControlThread::waitFor(atomic<uint32_t>& counter, const uint32_t target)
+{
+    for (uint64_t i = 0; i < BARRIER_SPINS; i++) {
+        if (static_cast<int32_t>(counter.load() - target) >= 0) {
+            return;
+        }
+        this_thread::yield();
+    }
+    parked++;
+    uint32_t now = counter.load();
+    while (static_cast<int32_t>(now - target) < 0) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&counter),
+            FUTEX_WAIT_PRIVATE, now, nullptr, nullptr, 0);
+        now = counter.load();
+    }
+    parked--;
+}
+
+void ControlThread::wakeAll(atomic<uint32_t>& counter)
+{
+    if (parked.load() > 0) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&counter),
+            FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+    }
+}
+
+void ControlThread::releaseToRun(const uint64_t& member)
+{
+    if (engine == ENGINE_EVENT) {
+        yieldFor(1);
+        return;
+    }
+    const uint32_t tickNow = round.load();
+    arrive(leafOf(member));
+    waitFor(round, tickNow + 1);
+}
+
+//sit out count ticks without taking part in the rounds between - the
+//member leaves the tree and is joined again on the tick it wakes
+void ControlThread::waitTicks(const uint64_t& member, const uint64_t& count)
+{
+    if (count == 0) {
+        return;
+    }
+    if (engine == ENGINE_EVENT) {
+        yieldFor(count);
+        return;
+    }
+    if (count == 1) {
+        releaseToRun(member);
+        return;
+    }
+    //the tick cannot move on while we are still to arrive
+    const uint64_t wakeTick = ticks + count;
+    sleepLock.lock();
+    sleepers.insert(pair<uint64_t, uint64_t>(wakeTick, member));
+    nextWake = sleepers.begin()->first;
+    sleepLock.unlock();
+    leave(leafOf(member));
+    waitFor(round, static_cast<uint32_t>(wakeTick));
+}
+
+//a member ahead of the barrier on local work leaves it as a sleeper due
+//when the rest reach its clock - the rest can never pass a tick it might
+//still do something shared on
+uint64_t ControlThread::runAhead(const uint64_t& member, const uint64_t& count)
+{
+    const uint64_t wakeTick = ticks + count;
+    sleepLock.lock();
+    sleepers.insert(pair<uint64_t, uint64_t>(wakeTick, member));
+    nextWake = sleepers.begin()->first;
+    sleepLock.unlock();
+    leave(leafOf(member));
+    return wakeTick;
+}
+
+//a later wake for a sleeping member - false if it has already been
+//joined again, in which case the barrier is waiting on it
+bool ControlThread::moveSleeper(const uint64_t& member, const uint64_t& from,
+    const uint64_t& to)
+{
+    lock_guard<mutex> lock(sleepLock);
+    auto range = sleepers.equal_range(from);
+    for (auto it = range.first; it != range.second; it++) {
+        if (it->second == member) {
+            sleepers.erase(it);
+            sleepers.insert(pair<uint64_t, uint64_t>(to, member));
+            nextWake = sleepers.begin()->first;
+            return true;
+        }
+    }
+    return false;
+}
+
+//publish count more ticks run ahead - false if the barrier caught up
+//and held the tick for us
+bool ControlThread::extendRunAhead(const uint64_t& member, uint64_t& wake,
+    const uint64_t& count)
+{
+    if (moveSleeper(member, wake, wake + count)) {
+        wake += count;
+        return true;
+    }
+    wake = runAhead(member, count);
+    return false;
+}
+
+//about to do something shared count ticks past the published clock -
+//wait for the barrier to get there
+bool ControlThread::catchUp(const uint64_t& member, const uint64_t& wake,
+    const uint64_t& count)
+{
+    if (moveSleeper(member, wake, wake + count)) {
+        waitFor(round, static_cast<uint32_t>(wake + count));
+        return true;
+    }
+    waitTicks(member, count);
+    return false;
+}
+
+//rejoin members due on this tick - no one is running, so leaves may
+//safely rejoin their parents
+void ControlThread::wakeSleepers()
+{
+    if (nextWake.load() > ticks) {
+        return;
+    }
+    lock_guard<mutex> lock(sleepLock);
+    joinDue();
+}
+
+void ControlThread::joinDue()
+{
+    while (!sleepers.empty() && sleepers.begin()->first <= ticks) {
+        join(leafOf(sleepers.begin()->second));
+        sleepers.erase(sleepers.begin());
+    }
+    nextWake = sleepers.empty() ? ULLONG_MAX : sleepers.begin()->first;
+}
+
+//every live member is sleeping - bring the clock forward to the first
+//of them to wake
+void ControlThread::skipAhead()
+{
+    //under the one lock, so a member running ahead cannot move the wake
+    //we are skipping to from under us
+    sleepLock.lock();
+    if (sleepers.empty()) {
+        sleepLock.unlock();
+        return;
+    }
+    const uint64_t skipped = sleepers.begin()->first - ticks;
+    advanceClock(skipped);
+    joinDue();
+    sleepLock.unlock();
+    round += skipped;
+    wakeAll(round);
+}
+
+void ControlThread::incrementTaskCount(const uint64_t& member)
+{
+    join(leafOf(member));
+}
+
+//tasks come and go as background transfers start and finish - leaving
+//may complete the tick for those already waiting
+void ControlThread::decrementTaskCount(const uint64_t& member)
+{
+    leave(leafOf(member));
 }
 
 void ControlThread::incrementBlocks()
 {
-	unique_lock<mutex> lck(runLock);
-	unique_lock<mutex> lckBlock(blockLock);
-	blockedInTree++;
-	lckBlock.unlock();
+    blockedInTree++;
+}
+
+//close the current tick and move the clock on
+void ControlThread::advanceClock(const uint64_t& count)
+{
+    if (arbiter) {
+        arbiter();
+    }
+    //published for the window to poll - nothing here waits on it
+    if (blockedInTree.load(memory_order_relaxed) > 0) {
+        mainWindow->telemetry.blocks.fetch_add(blockedInTree.exchange(0),
+            memory_order_relaxed);
+    }
+    ticks += count;
+    mainWindow->telemetry.ticks.store(ticks, memory_order_relaxed);
 }
 
+//called by whichever member completes the root - every other member
+//is waiting on the tick
 void ControlThread::run()
 {
-	unique_lock<mutex> lck(runLock);
-	unique_lock<mutex> lckBlock(blockLock);
-	if (blockedInTree > 0) {
-		cout << "On tick " << ticks << " total blocks ";
-		cout << blockedInTree << endl;
-		blockedInTree = 0;
-	}
-	lckBlock.unlock();
-	signedInCount = 0;
-	ticks++;
-	go.notify_all();
-	//update LCD display
-	++(mainWindow->currentCycles);
-	emit updateCycles();
+    advanceClock(1);
+    wakeSleepers();
+    round++;
+    wakeAll(round);
 }
 
 void ControlThread::waitForBegin()
@@ -81,12 +444,249 @@ void ControlThread::waitForBegin()
 	go.wait(lck, [&]() { return this->beginnable;});
 }
 
+//lockstep members are already running and wait for this - the event
+//engine runs the whole simulation from here
 void ControlThread::begin()
 {
 	runLock.lock();
 	beginnable = true;
 	go.notify_all();
 	runLock.unlock();
+	if (engine == ENGINE_EVENT) {
+		runEvents();
+	}
+}
+
+//start a member - a thread counted in at the barrier, or a coroutine
+//first resumed on the current tick
+thread *ControlThread::launch(const uint64_t& member,
+	const function<void()>& body, const uint64_t& stackBytes)
+{
+	if (engine != ENGINE_EVENT) {
+		incrementTaskCount(member);
+		thread *host = new thread([this, member, body]() {
+			body();
+			decrementTaskCount(member);
+		});
+		if (!placement.empty()) {
+			pin(host, placement[member % placement.size()]);
+		}
+		return host;
+	}
+	Coroutine *coroutine = new Coroutine(body, stackBytes, member);
+	getcontext(&coroutine->context);
+	coroutine->context.uc_stack.ss_sp = coroutine->stack;
+	coroutine->context.uc_stack.ss_size = stackBytes;
+	coroutine->context.uc_link = nullptr;
+	//makecontext only passes ints
+	const uint64_t self = reinterpret_cast<uint64_t>(this);
+	makecontext(&coroutine->context,
+		reinterpret_cast<void (*)()>(&ControlThread::enter), 2,
+		static_cast<unsigned int>(self >> 32),
+		static_cast<unsigned int>(self));
+	//launched mid-tick - run it on this worker before the tick closes
+	EventWorker *worker = runningWorker();
+	if (worker) {
+		outstanding++;
+		lock_guard<mutex> lock(worker->readyLock);
+		worker->ready.push_back(coroutine);
+	} else {
+		calendar.schedule(ticks, coroutine);
+	}
+	return nullptr;
+}
+
+//coroutines move between workers, so the worker is looked up afresh
+//rather than through a thread-local address cached across a switch
+static thread_local EventWorker *localWorker = nullptr;
+
+EventWorker *ControlThread::runningWorker()
+{
+	return localWorker;
+}
+
+void ControlThread::enter(unsigned int high, unsigned int low)
+{
+	ControlThread *control = reinterpret_cast<ControlThread *>(
+		(static_cast<uint64_t>(high) << 32) | low);
+	Coroutine *coroutine = control->runningWorker()->current;
+	coroutine->body();
+	coroutine->finished = true;
+	setcontext(&control->runningWorker()->schedulerContext);
+}
+
+//back to the worker until the member's next tick comes round
+void ControlThread::yieldFor(const uint64_t& count)
+{
+	EventWorker *worker = runningWorker();
+	Coroutine *coroutine = worker->current;
+	worker->scheduled.push_back(
+		pair<uint64_t, Coroutine *>(ticks + count, coroutine));
+	swapcontext(&coroutine->context, &worker->schedulerContext);
+}
+
+void ControlThread::resume(EventWorker *worker, Coroutine *coroutine)
+{
+	worker->current = coroutine;
+	swapcontext(&worker->schedulerContext, &coroutine->context);
+	worker->current = nullptr;
+	if (coroutine->finished) {
+		delete coroutine;
+	}
+	outstanding--;
+}
+
+//own work newest first, then steal the oldest from the others
+Coroutine *ControlThread::takeWork(const uint64_t& id)
+{
+	for (uint64_t i = 0; i < workers.size(); i++) {
+		EventWorker *victim = workers[(id + i) % workers.size()];
+		lock_guard<mutex> lock(victim->readyLock);
+		if (victim->ready.empty()) {
+			continue;
+		}
+		Coroutine *coroutine;
+		if (i == 0) {
+			coroutine = victim->ready.back();
+			victim->ready.pop_back();
+		} else {
+			coroutine = victim->ready.front();
+			victim->ready.pop_front();
+		}
+		return coroutine;
+	}
+	return nullptr;
+}
+
+void ControlThread::runTick(const uint64_t& id)
+{
+	while (outstanding.load() > 0) {
+		Coroutine *coroutine = takeWork(id);
+		if (coroutine == nullptr) {
+			this_thread::yield();
+			continue;
+		}
+		resume(workers[id], coroutine);
+	}
+}
+
+void ControlThread::workerLoop(const uint64_t& id)
+{
+	localWorker = workers[id];
+	uint32_t seen = 0;
+	while (true) {
+		waitFor(epoch, seen + 1);
+		seen = epoch.load();
+		if (stopping) {
+			return;
+		}
+		runTick(id);
+	}
+}
+
+//hand each tick's members out across the workers, let them run and
+//steal, then close the tick - idle ticks between events cost nothing
+void ControlThread::runEvents()
+{
+	for (uint64_t i = 0; i < workerCount; i++) {
+		workers.push_back(new EventWorker());
+	}
+	vector<thread *> pool;
+	for (uint64_t i = 1; i < workerCount; i++) {
+		pool.push_back(new thread(&ControlThread::workerLoop, this, i));
+	}
+	//workers take a block of tiles each, so spread them as the tiles
+	//would be spread
+	if (!cores.empty()) {
+		for (uint64_t i = 0; i < workerCount; i++) {
+			const int core = cores[i * cores.size() / workerCount];
+			pin(i == 0 ? nullptr : pool[i - 1], core);
+			cout << "Worker " << i << " pinned to CPU " << core << endl;
+		}
+	}
+	localWorker = workers[0];
+	vector<Coroutine *> due;
+	while (true) {
+		for (auto worker: workers) {
+			for (auto& event: worker->scheduled) {
+				calendar.schedule(event.first, event.second);
+			}
+			worker->scheduled.clear();
+		}
+		if (calendar.empty()) {
+			break;
+		}
+		const uint64_t next = calendar.nextTick(ticks);
+		if (next > ticks) {
+			advanceClock(next - ticks);
+		}
+		calendar.takeDue(ticks, due);
+		outstanding = due.size();
+		for (uint64_t i = 0; i < due.size(); i++) {
+			EventWorker *worker = workers[
+				(due[i]->member % memberCount) * workerCount /
+				memberCount];
+			lock_guard<mutex> lock(worker->readyLock);
+			worker->ready.push_back(due[i]);
+		}
+		due.clear();
+		epoch++;
+		wakeAll(epoch);
+		runTick(0);
+		advanceClock(1);
+	}
+	stopping = true;
+	epoch++;
+	wakeAll(epoch);
+	for (auto worker: pool) {
+		worker->join();
+		delete worker;
+	}
+	localWorker = nullptr;
+}
+
+void CalendarQueue::schedule(const uint64_t& tick, Coroutine *event)
+{
+	days[tick % CALENDAR_DAYS].push_back(
+		pair<uint64_t, Coroutine *>(tick, event));
+	count++;
+}
+
+//first tick with an event, looking a year ahead before searching the lot
+uint64_t CalendarQueue::nextTick(const uint64_t& today) const
+{
+	for (uint64_t i = 0; i < CALENDAR_DAYS; i++) {
+		for (auto& event: days[(today + i) % CALENDAR_DAYS]) {
+			if (event.first == today + i) {
+				return today + i;
+			}
+		}
+	}
+	uint64_t first = ULLONG_MAX;
+	for (auto& day: days) {
+		for (auto& event: day) {
+			if (event.first < first) {
+				first = event.first;
+			}
+		}
+	}
+	return first;
+}
+
+bool CalendarQueue::takeDue(const uint64_t& tick, vector<Coroutine *>& due)
+{
+	vector<pair<uint64_t, Coroutine *> >& day = days[tick % CALENDAR_DAYS];
+	uint64_t kept = 0;
+	for (uint64_t i = 0; i < day.size(); i++) {
+		if (day[i].first == tick) {
+			due.push_back(day[i].second);
+		} else {
+			day[kept++] = day[i];
+		}
+	}
+	day.resize(kept);
+	count -= due.size();
+	return !due.empty();
 }
 
 bool ControlThread::tryCheatLock()
@@ -2,42 +2,172 @@
 #include <iostream>
 #include <mutex>
 #include <thread>
+#include <atomic>
+#include <map>
+#include <vector>
+#include <deque>
+#include <functional>
 #include <condition_variable>
+#include <ucontext.h>
 #include "mainwindow.h"
 
 #ifndef __CONTROLTHREAD_
 #define __CONTROLTHREAD_
 
+//members (tiles and their carrier threads, by tile order) arrive at a
+//leaf shared by BARRIER_FANIN tiles; full nodes arrive at their parent
+//and the root completes the tick
+static const uint64_t BARRIER_FANIN = 4;
+//polls of the tick count, yielding between them, before a waiter
+//parks on the futex
+static const uint64_t BARRIER_SPINS = 2000;
 
+//how simulated time moves: every member on its own thread meeting at
+//the barrier each tick, or members as coroutines resumed in tick order
+//from a calendar queue by a pool of worker threads - the optimistic
+//engine is lockstep with tiles running ahead on local work, leaving the
+//barrier with their own clock as the tick it must wait for them on -
+//nothing is speculated, so nothing is ever rolled back
+enum SimulationEngine {ENGINE_LOCKSTEP, ENGINE_EVENT, ENGINE_OPTIMISTIC};
+//calendar days - a power of two comfortably past the usual delay
+static const uint64_t CALENDAR_DAYS = 256;
+static const uint64_t TILE_STACK_BYTES = 2 * 1024 * 1024;
+static const uint64_t CARRIER_STACK_BYTES = 256 * 1024;
+
+//arrived count in the high word, expected count in the low word,
+//padded so no two nodes share a cache line
+class BarrierNode {
+public:
+	std::atomic<uint64_t> state;
+	long parent;
+	char padding[64 - sizeof(std::atomic<uint64_t>) - sizeof(long)];
+	BarrierNode(): state(0), parent(-1) {}
+};
+
+//a member run as a coroutine by the event engine
+class Coroutine {
+public:
+	ucontext_t context;
+	char *stack;
+	std::function<void()> body;
+	bool finished;
+	const uint64_t member;
+	Coroutine(const std::function<void()>& fn, const uint64_t& stackBytes,
+		const uint64_t& mem):
+		stack(new char[stackBytes]), body(fn), finished(false),
+		member(mem) {}
+	~Coroutine() { delete[] stack; }
+};
+
+//events bucketed by tick modulo CALENDAR_DAYS - a bucket may also hold
+//events a year or more ahead, which are left for their own day
+class CalendarQueue {
+private:
+	std::vector<std::vector<std::pair<uint64_t, Coroutine *> > > days;
+	uint64_t count;
+
+public:
+	CalendarQueue(): days(CALENDAR_DAYS), count(0) {}
+	void schedule(const uint64_t& tick, Coroutine *event);
+	bool empty() const { return count == 0; }
+	uint64_t nextTick(const uint64_t& today) const;
+	bool takeDue(const uint64_t& tick, std::vector<Coroutine *>& due);
+};
+
+//a host thread of the event engine - it runs members from its own
+//deque and steals from the others'; members it puts back to sleep are
+//filed in the calendar when the tick closes
+class EventWorker {
+public:
+	std::deque<Coroutine *> ready;
+	std::mutex readyLock;
+	std::vector<std::pair<uint64_t, Coroutine *> > scheduled;
+	ucontext_t schedulerContext;
+	Coroutine *current;
+	EventWorker(): current(nullptr) {}
+};
 
 class ControlThread: public QObject {
     Q_OBJECT
 
-signals:
-    void updateCycles();
-
 private:
 	uint64_t ticks;
-	volatile uint16_t taskCount;
-	volatile uint16_t signedInCount;
-	volatile uint16_t blockedInTree;
+	std::atomic<uint32_t> round;
+	std::atomic<uint32_t> parked;
+	std::atomic<uint64_t> blockedInTree;
+	BarrierNode *nodes;
+	uint64_t nodeCount;
+	uint64_t leafCount;
+	const uint64_t memberCount;
+	//host cores in topology order, and the one each member runs on -
+	//empty unless pinned
+	std::vector<int> cores;
+	std::vector<int> placement;
+	void pin(std::thread *host, const int& core);
+	//members sitting out ticks, by the tick they rejoin on
+	std::multimap<uint64_t, uint64_t> sleepers;
+	std::atomic<uint64_t> nextWake;
+	std::mutex sleepLock;
 	std::mutex runLock;
 	bool beginnable;
 	std::condition_variable go;
-	std::mutex taskCountLock;
-	std::mutex blockLock;
 	std::mutex cheatLock;
 	MainWindow *mainWindow;
+	const SimulationEngine engine;
+	//settles contention in the tree as each tick closes
+	std::function<void()> arbiter;
+	const uint64_t workerCount;
+	CalendarQueue calendar;
+	std::vector<EventWorker *> workers;
+	std::atomic<uint64_t> outstanding;
+	std::atomic<uint32_t> epoch;
+	std::atomic<bool> stopping;
+	void advanceClock(const uint64_t& count);
+	void waitFor(std::atomic<uint32_t>& counter, const uint32_t target);
+	void wakeAll(std::atomic<uint32_t>& counter);
+	static EventWorker *runningWorker() __attribute__((noinline));
+	static void enter(unsigned int high, unsigned int low);
+	void yieldFor(const uint64_t& count);
+	void resume(EventWorker *worker, Coroutine *coroutine);
+	Coroutine *takeWork(const uint64_t& id);
+	void runTick(const uint64_t& id);
+	void workerLoop(const uint64_t& id);
+	void runEvents();
 	void run();
+	void join(long node);
+	void leave(long node);
+	void arrive(long node);
+	long leafOf(const uint64_t& member) const;
+	void wakeSleepers();
+	void joinDue();
+	void skipAhead();
+	bool moveSleeper(const uint64_t& member, const uint64_t& from,
+		const uint64_t& to);
 
 public:
-	ControlThread(unsigned long count = 0, MainWindow *pWind = nullptr);
-	void incrementTaskCount();
-	void decrementTaskCount();
+	ControlThread(unsigned long count = 0, MainWindow *pWind = nullptr,
+		unsigned long members = 1,
+		SimulationEngine eng = ENGINE_LOCKSTEP,
+		unsigned long workerThreads = 1);
+	~ControlThread();
+	void incrementTaskCount(const uint64_t& member);
+	void decrementTaskCount(const uint64_t& member);
 	void incrementBlocks();
 	void begin();
-	void releaseToRun();
+	void releaseToRun(const uint64_t& member);
+	void waitTicks(const uint64_t& member, const uint64_t& count);
+	bool runsAhead() const { return engine == ENGINE_OPTIMISTIC; }
+	uint64_t currentTick() const { return ticks; }
+	void setArbiter(const std::function<void()>& fn) { arbiter = fn; }
+	void pinThreads();
+	uint64_t runAhead(const uint64_t& member, const uint64_t& count);
+	bool extendRunAhead(const uint64_t& member, uint64_t& wake,
+		const uint64_t& count);
+	bool catchUp(const uint64_t& member, const uint64_t& wake,
+		const uint64_t& count);
 	void waitForBegin();
+	std::thread *launch(const uint64_t& member,
+		const std::function<void()>& body, const uint64_t& stackBytes);
 	bool tryCheatLock();
 	void unlockCheatLock();
 };
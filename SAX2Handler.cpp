@@ -24,6 +24,8 @@ using namespace std;
 #define store 2
 #define modify 3
 #define nothing 4
+#define pin 5
+#define unpin 6
 
 static const int parseType(string memType)
 {
@@ -39,6 +41,12 @@ static const int parseType(string memType)
     else if (memType == "modify") {
         return modify;
     }
+    else if (memType == "pin") {
+        return pin;
+    }
+    else if (memType == "unpin") {
+        return unpin;
+    }
     return nothing;
 }
 
@@ -111,6 +119,25 @@ void SAX2Handler::startElement(const XMLCh* const uri,
                 XMLString::release(&sizeStr);
 		XMLString::release(&memAccess);
                 break;
+            case pin:
+            case unpin:
+                //size of the range in bytes - a page if not given
+                {
+                    const uint64_t rangeSize = size ? stoul(size) : 1;
+                    if (typeXML == pin) {
+                        memoryHandler->proc->pinRange(uiAddress,
+                            rangeSize);
+                    } else {
+                        memoryHandler->proc->unpinRange(uiAddress,
+                            rangeSize);
+                    }
+                }
+                XMLString::release(&address);
+                XMLString::release(&size);
+                XMLString::release(&addressStr);
+                XMLString::release(&sizeStr);
+		XMLString::release(&memAccess);
+                break;
             default:
                 XMLString::release(&address);
                 XMLString::release(&size);
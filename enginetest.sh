@@ -0,0 +1,34 @@
+#!/bin/sh
+#run the same traces under the lockstep and optimistic engines, both
+#with deterministic arbitration, and check every tile reports the same
+#ticks for each pass both runs got through - run it where the lackeyml_
+#traces are: enginetest.sh [noc-qt binary] [seconds per run]
+
+NOCQT=${1:-./noc-qt}
+SECONDS_PER_RUN=${2:-60}
+OUT=${TMPDIR:-/tmp}/enginetest.$$
+mkdir -p $OUT || exit 1
+
+for engine in lockstep optimistic; do
+    timeout $SECONDS_PER_RUN $NOCQT -c 2 -r 2 -e $engine -d \
+        > $OUT/$engine.out 2>&1
+    #tile, pass and ticks for each pass completed
+    awk '/^Task on/ {tile = $3}
+        /^Ticks:/ {print tile ":" pass[tile]++, $2}' \
+        $OUT/$engine.out | sort > $OUT/$engine.ticks
+done
+
+join -o 1.2,2.2 $OUT/lockstep.ticks $OUT/optimistic.ticks > $OUT/both.ticks
+passes=$(wc -l < $OUT/both.ticks)
+differ=$(awk '$1 != $2' $OUT/both.ticks | wc -l)
+rm -rf $OUT
+
+if [ $passes -eq 0 ]; then
+    echo "no pass completed under both engines"
+    exit 1
+fi
+if [ $differ -ne 0 ]; then
+    echo "$differ of $passes passes took different ticks"
+    exit 1
+fi
+echo "$passes passes took the same ticks under both engines"
@@ -1,8 +1,13 @@
 #include <iostream>
+#include <map>
+#include <string>
 #include "mainwindow.h"
+#include "ControlThread.hpp"
 #include <QApplication>
 
 static const unsigned long PAGE_SHIFT = 9;
+static const unsigned long LINE_SHIFT = 4;
+static const unsigned long LOCAL_MEMORY = 16 * 1024;
 
 using namespace std;
 
@@ -15,6 +20,26 @@ void usage() {
     cout << "-r    Rows of CPUs in NoC (default 16)" << endl;
     cout << "-c    Columns of CPUs in NoC (default 16)" << endl;
     cout << "-p    Page size in power of 2 (default 10)" << endl;
+    cout << "-l    Sub-page line size in power of 2 (default 4)" << endl;
+    cout << "-m    Local memory per tile in bytes (default 16384)" << endl;
+    cout << "-t    Local memory for one tile as tile:bytes" << endl;
+    cout << "-e    Engine: lockstep (default), event or optimistic" << endl;
+    cout << "-w    Event engine worker threads (default one per core)" << endl;
+    cout << "-d    Deterministic arbitration in the tree" << endl;
+    cout << "-a    Pin threads to host cores by tree subtree" << endl;
+    cout << "-k    Longest write-back burst in lines (default 8)" << endl;
+    cout << "-f    Stride prefetch ahead of small faults" << endl;
+    cout << "-q    Store buffer entries (default 0, stores unbuffered)" << endl;
+    cout << "-i    Interrupt register save: full (default), shadow or lazy" << endl;
+    cout << "-h    Walk a hashed page table on TLB misses" << endl;
+    cout << "-x    Traces time-sliced on each tile (default 1)" << endl;
+    cout << "-u    Flush untagged TLBs on context switches" << endl;
+    cout << "-o    Fetch read-only pages from nearby tiles" << endl;
+    cout << "-g    Adapt each frame's fetch block to its faults" << endl;
+    cout << "-n    Load misses in flight (default 0, load misses block)" << endl;
+    cout << "-j    Code lines in the stream buffer (default 0, none)" << endl;
+    cout << "-v    Frames pin directives may hold (default 4)" << endl;
+    cout << "-y    Run local work a quantum ahead (set by -e optimistic)" << endl;
     cout << "-?    Print this message and exit" << endl;
 }
 
@@ -27,6 +52,14 @@ int main(int argc, char *argv[])
     long rows = 16;
     long columns = 8;
     long pageShift = PAGE_SHIFT;
+    long lineShift = LINE_SHIFT;
+    uint64_t localMemory = LOCAL_MEMORY;
+    map<long, uint64_t> tileMemory;
+    SimulationEngine engine = ENGINE_LOCKSTEP;
+    unsigned long workers = thread::hardware_concurrency();
+    bool deterministic = false;
+    bool pinned = false;
+    ProcessorOptions processorOptions;
 
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-?") == 0) {
@@ -53,27 +86,189 @@ int main(int argc, char *argv[])
             pageShift = atol(argv[++i]);
             continue;
         }
+        if (strcmp(argv[i], "-l") == 0) {
+            lineShift = atol(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "-m") == 0) {
+            localMemory = atol(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "-t") == 0) {
+            string overrideStr(argv[++i]);
+            size_t colon = overrideStr.find(':');
+            if (colon == string::npos) {
+                usage();
+                exit(EXIT_FAILURE);
+            }
+            tileMemory[atol(overrideStr.substr(0, colon).c_str())] =
+                atol(overrideStr.substr(colon + 1).c_str());
+            continue;
+        }
+        if (strcmp(argv[i], "-e") == 0) {
+            string engineStr(argv[++i]);
+            if (engineStr == "lockstep") {
+                engine = ENGINE_LOCKSTEP;
+            } else if (engineStr == "event") {
+                engine = ENGINE_EVENT;
+            } else if (engineStr == "optimistic") {
+                engine = ENGINE_OPTIMISTIC;
+            } else {
+                usage();
+                exit(EXIT_FAILURE);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-w") == 0) {
+            workers = atol(argv[++i]);
+            if (workers == 0) {
+                usage();
+                exit(EXIT_FAILURE);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-d") == 0) {
+            deterministic = true;
+            continue;
+        }
+        if (strcmp(argv[i], "-a") == 0) {
+            pinned = true;
+            continue;
+        }
+        if (strcmp(argv[i], "-k") == 0) {
+            processorOptions.burstLines = atol(argv[++i]);
+            if (processorOptions.burstLines == 0) {
+                usage();
+                exit(EXIT_FAILURE);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-f") == 0) {
+            processorOptions.stridePrefetch = true;
+            continue;
+        }
+        if (strcmp(argv[i], "-q") == 0) {
+            processorOptions.storeBufferEntries = atol(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "-i") == 0) {
+            string saveStr(argv[++i]);
+            if (saveStr == "full") {
+                processorOptions.interruptSave = SAVE_FULL;
+            } else if (saveStr == "shadow") {
+                processorOptions.interruptSave = SAVE_SHADOW;
+            } else if (saveStr == "lazy") {
+                processorOptions.interruptSave = SAVE_LAZY;
+            } else {
+                usage();
+                exit(EXIT_FAILURE);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-h") == 0) {
+            processorOptions.hashedPageTable = true;
+            continue;
+        }
+        if (strcmp(argv[i], "-x") == 0) {
+            processorOptions.contexts = atol(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "-u") == 0) {
+            processorOptions.taggedTLB = false;
+            continue;
+        }
+        if (strcmp(argv[i], "-o") == 0) {
+            processorOptions.cooperativeCaching = true;
+            continue;
+        }
+        if (strcmp(argv[i], "-g") == 0) {
+            processorOptions.adaptiveFetch = true;
+            continue;
+        }
+        if (strcmp(argv[i], "-n") == 0) {
+            processorOptions.mshrCount = atol(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "-j") == 0) {
+            processorOptions.streamBufferLines = atol(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "-v") == 0) {
+            processorOptions.pinBudget = atol(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "-y") == 0) {
+            processorOptions.lookaheadQuanta = true;
+            continue;
+        }
 
         //unrecognised option
         usage();
         exit(EXIT_FAILURE);
     }
 
+    //the optimistic engine runs ahead a quantum at a time
+    if (engine == ENGINE_OPTIMISTIC) {
+        processorOptions.lookaheadQuanta = true;
+    }
+
     long totalTiles = rows * columns;
     if ((totalTiles == 0) || (totalTiles & (totalTiles - 1))) {
         cout << "Must have power of two for number of tiles." << endl;
         exit(EXIT_FAILURE);
     }
 
+    //smallest line is a long, largest is the whole page
+    if (lineShift < 3 || lineShift > pageShift) {
+        cout << "Line size must be between 8 bytes and the page size." << endl;
+        exit(EXIT_FAILURE);
+    }
 
+    //each context needs its own ASID
+    if (processorOptions.contexts == 0 ||
+        processorOptions.contexts > MAX_CONTEXTS) {
+        cout << "Contexts per tile must be between 1 and ";
+        cout << MAX_CONTEXTS << "." << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    //local memories are whole pages - the tables and stack are
+    //laid out in frames
+    auto wholePages = [pageShift](const uint64_t size) {
+        return size > 0 && !(size & ((1ULL << pageShift) - 1));
+    };
+    if (!wholePages(localMemory)) {
+        cout << "Local memory must be a whole number of pages." << endl;
+        exit(EXIT_FAILURE);
+    }
+    for (auto& memory: tileMemory) {
+        if (memory.first < 0 || memory.first >= totalTiles) {
+            cout << "No tile " << memory.first << " to size." << endl;
+            exit(EXIT_FAILURE);
+        }
+        if (!wholePages(memory.second)) {
+            cout << "Local memory must be a whole number of pages." << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
 
     QApplication a(argc, argv);
     MainWindow w;
     w.setColumns(columns);
     w.setRows(rows);
     w.setPageShift(pageShift);
+    w.setLineShift(lineShift);
     w.setMemoryBlocks(memoryBlocks);
     w.setBlockSize(blockSize);
+    w.setLocalMemory(localMemory);
+    w.setEngine(engine);
+    w.setWorkers(workers);
+    w.setDeterministic(deterministic);
+    w.setPinned(pinned);
+    w.setProcessorOptions(processorOptions);
+    for (auto& memory: tileMemory) {
+        w.setTileMemory(memory.first, memory.second);
+    }
     w.show();
 
     return a.exec();
@@ -19,7 +19,10 @@ MainWindow::MainWindow(QWidget *parent) :
     ui(new Ui::MainWindow)
 {
     ui->setupUi(this);
-    currentCycles = 0;
+    blocksReported = 0;
+    telemetryTimer = new QTimer(this);
+    connect(telemetryTimer, SIGNAL(timeout()), this, SLOT(updateLCD()));
+    telemetryTimer->start(TELEMETRY_INTERVAL_MS);
 }
 
 MainWindow::~MainWindow()
@@ -33,17 +36,25 @@ private:
     uint64_t columns;
     uint64_t rows;
     uint64_t pageShift;
+    uint64_t lineShift;
     uint64_t memoryBlocks;
     uint64_t blockSize;
+    uint64_t localMemory;
+    std::map<long, uint64_t> tileMemory;
+    uint64_t engine;
+    uint64_t workers;
+    bool deterministic;
+    bool pinned;
+    ProcessorOptions processorOptions;
     MainWindow *mW;
 
 public:
-    ExecuteFunctor(uint64_t c, uint64_t r, uint64_t pS, uint64_t mB, uint64_t bS, MainWindow *wind):
-        columns(c), rows(r), pageShift(pS), memoryBlocks(mB), blockSize(bS), mW(wind) {}
+    ExecuteFunctor(uint64_t c, uint64_t r, uint64_t pS, uint64_t lS, uint64_t mB, uint64_t bS, uint64_t lM, const std::map<long, uint64_t>& tM, uint64_t eng, uint64_t wk, bool det, bool pin, const ProcessorOptions& pO, MainWindow *wind):
+        columns(c), rows(r), pageShift(pS), lineShift(lS), memoryBlocks(mB), blockSize(bS), localMemory(lM), tileMemory(tM), engine(eng), workers(wk), deterministic(det), pinned(pin), processorOptions(pO), mW(wind) {}
 
     void operator() ()
     {
-        Noc networkTiles(columns, rows, pageShift, blockSize, mW, memoryBlocks);
+        Noc networkTiles(columns, rows, pageShift, lineShift, blockSize, localMemory, tileMemory, mW, memoryBlocks, static_cast<SimulationEngine>(engine), workers, deterministic, pinned, processorOptions);
         //Let's Go!
         networkTiles.executeInstructions();
     }
@@ -60,33 +71,59 @@ void MainWindow::on_pushButton_clicked()
         cerr << "Must have power of two for number of tiles." << endl;
         exit(EXIT_FAILURE);
     }
-    ExecuteFunctor eF(columns, rows, pageShift, memoryBlocks, blockSize, this);
+    ExecuteFunctor eF(columns, rows, pageShift, lineShift, memoryBlocks, blockSize, localMemory, tileMemory, engine, workers, deterministic, pinned, processorOptions, this);
     std::thread t(eF);
     t.detach();
 
 }
 
-void MainWindow::updateLCD()
+void Telemetry::enrol(const FaultCounters *counters)
 {
-    ui->lcdNumber->display(currentCycles);
-    ui->lcdNumber->update();
+    lock_guard<mutex> lock(sourcesLock);
+    faultSources.push_back(counters);
 }
 
-void MainWindow::updateHardFaults()
+void Telemetry::withdraw(const FaultCounters *counters)
 {
-    hardFaultMutex.lock();
-    int hardFaultCount = ui->lcdNumber_2->intValue();
-    ui->lcdNumber_2->display(++hardFaultCount);
-    hardFaultMutex.unlock();
-    ui->lcdNumber_2->update();
+    lock_guard<mutex> lock(sourcesLock);
+    for (auto it = faultSources.begin(); it != faultSources.end(); it++) {
+        if (*it == counters) {
+            retiredHard += counters->hard.load(memory_order_relaxed);
+            retiredSmall += counters->small.load(memory_order_relaxed);
+            faultSources.erase(it);
+            return;
+        }
+    }
+}
 
+void Telemetry::sumFaults(uint64_t& hard, uint64_t& small)
+{
+    lock_guard<mutex> lock(sourcesLock);
+    hard = retiredHard;
+    small = retiredSmall;
+    for (auto counters: faultSources) {
+        hard += counters->hard.load(memory_order_relaxed);
+        small += counters->small.load(memory_order_relaxed);
+    }
 }
 
-void MainWindow::updateSmallFaults()
+//sample the published progress - packets blocked in the tree are
+//reported for the interval since the last sample
+void MainWindow::updateLCD()
 {
-    smallFaultMutex.lock();
-    int smallFaultCount = ui->lcdNumber_3->intValue();
-    ui->lcdNumber_3->display(++smallFaultCount);
-    smallFaultMutex.unlock();
+    const uint64_t ticks = telemetry.ticks.load(memory_order_relaxed);
+    const uint64_t blocks = telemetry.blocks.load(memory_order_relaxed);
+    uint64_t hardFaults, smallFaults;
+    telemetry.sumFaults(hardFaults, smallFaults);
+    if (blocks != blocksReported) {
+        cout << "On tick " << ticks << " total blocks ";
+        cout << blocks - blocksReported << endl;
+        blocksReported = blocks;
+    }
+    ui->lcdNumber->display(static_cast<int>(ticks));
+    ui->lcdNumber->update();
+    ui->lcdNumber_2->display(static_cast<int>(hardFaults));
+    ui->lcdNumber_2->update();
+    ui->lcdNumber_3->display(static_cast<int>(smallFaults));
     ui->lcdNumber_3->update();
 }
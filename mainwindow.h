@@ -3,12 +3,109 @@
 
 #include <QMainWindow>
 #include <QLCDNumber>
+#include <QTimer>
 #include <mutex>
+#include <map>
+#include <vector>
+#include <atomic>
 
 namespace Ui {
 class MainWindow;
 }
 
+//how often the window polls the simulation's progress
+static const int TELEMETRY_INTERVAL_MS = 100;
+
+//faults taken by one processor - written only by that processor and
+//read by the window's sampler, padded on both sides so neither the
+//processor's own fields nor a neighbour share their cache line
+class FaultCounters {
+private:
+    char lead[64];
+
+public:
+    std::atomic<uint64_t> hard;
+    std::atomic<uint64_t> small;
+    FaultCounters(): hard(0), small(0) {}
+    //a single writer needs no locked add
+    static void count(std::atomic<uint64_t>& counter)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + 1,
+            std::memory_order_relaxed);
+    }
+
+private:
+    char trail[64 - 2 * sizeof(std::atomic<uint64_t>)];
+};
+
+//how interrupts keep the register file - spill all of it to the stack,
+//switch to a shadow bank, or spill only what the handler uses
+enum InterruptSave { SAVE_FULL, SAVE_SHADOW, SAVE_LAZY };
+
+//contexts on a tile each take one of the eight-bit ASIDs
+static const uint64_t MAX_CONTEXTS = 256;
+
+//how every tile's processor is built - set once from the command line
+class ProcessorOptions {
+public:
+    //longest run of dirty lines sent back as a single packet
+    uint64_t burstLines;
+    //run ahead of small faults that repeat a stride
+    bool stridePrefetch;
+    //write-combining store buffer - lines held before stores must
+    //drain (0 sends every store straight to memory)
+    uint64_t storeBufferEntries;
+    InterruptSave interruptSave;
+    //walk a hash of pages to frames rather than scan the page table
+    bool hashedPageTable;
+    //traces time-sliced on each tile, and whether their TLB entries
+    //are tagged with the context or flushed on every switch
+    uint64_t contexts;
+    bool taggedTLB;
+    //ask nearby tiles for read-only pages before global memory
+    bool cooperativeCaching;
+    //widen and narrow each frame's fetch block with its faults
+    bool adaptiveFetch;
+    //miss status holding registers - load misses outstanding before
+    //one stalls (0 makes every load miss block)
+    uint64_t mshrCount;
+    //instruction stream buffer - code lines fetched ahead of a
+    //sequential miss (0 turns it off)
+    uint64_t streamBufferLines;
+    //most frames pin directives may hold resident at once
+    uint64_t pinBudget;
+    //local work runs up to LOOKAHEAD_QUANTUM ticks ahead of the
+    //barrier, catching up before anything shared - the tree, the mesh,
+    //global memory; the optimistic engine publishes each quantum and
+    //runs on
+    bool lookaheadQuanta;
+    ProcessorOptions(): burstLines(8), stridePrefetch(false),
+        storeBufferEntries(0), interruptSave(SAVE_FULL),
+        hashedPageTable(false), contexts(1), taggedTLB(true),
+        cooperativeCaching(false), adaptiveFetch(false), mshrCount(0),
+        streamBufferLines(0), pinBudget(4), lookaheadQuanta(false) {}
+};
+
+//progress published by the simulation as ticks close, read by the
+//window on its own timer - never a signal per tick
+class Telemetry {
+public:
+    std::atomic<uint64_t> ticks;
+    std::atomic<uint64_t> blocks;
+    Telemetry(): ticks(0), blocks(0), retiredHard(0), retiredSmall(0) {}
+    void enrol(const FaultCounters *counters);
+    void withdraw(const FaultCounters *counters);
+    void sumFaults(uint64_t& hard, uint64_t& small);
+
+private:
+    //every processor's counters, summed when the window samples - those
+    //of processors since destroyed are folded into the retired totals
+    std::vector<const FaultCounters *> faultSources;
+    std::mutex sourcesLock;
+    uint64_t retiredHard;
+    uint64_t retiredSmall;
+};
+
 class MainWindow : public QMainWindow
 {
     Q_OBJECT
@@ -18,10 +115,18 @@ private:
     uint64_t rows;
     uint64_t columns;
     uint64_t pageShift;
+    uint64_t lineShift;
     uint64_t blockSize;
     uint64_t memoryBlocks;
-    std::mutex hardFaultMutex;
-    std::mutex smallFaultMutex;
+    uint64_t localMemory;
+    std::map<long, uint64_t> tileMemory;
+    uint64_t engine;
+    uint64_t workers;
+    bool deterministic;
+    bool pinned;
+    ProcessorOptions processorOptions;
+    QTimer *telemetryTimer;
+    uint64_t blocksReported;
 
 public:
     explicit MainWindow(QWidget *parent = 0);
@@ -29,16 +134,24 @@ public:
     void setRows(const uint64_t r) {rows = r;}
     void setColumns(const uint64_t c) {columns = c;}
     void setPageShift(const uint64_t pS) {pageShift = pS;}
+    void setLineShift(const uint64_t lS) {lineShift = lS;}
     void setBlockSize(const uint64_t bS) {blockSize = bS;}
     void setMemoryBlocks(const uint64_t mB) {memoryBlocks = mB;}
-    int currentCycles;
+    void setLocalMemory(const uint64_t lM) {localMemory = lM;}
+    void setTileMemory(const long tile, const uint64_t size)
+        {tileMemory[tile] = size;}
+    void setEngine(const uint64_t eng) {engine = eng;}
+    void setWorkers(const uint64_t wk) {workers = wk;}
+    void setDeterministic(const bool det) {deterministic = det;}
+    void setPinned(const bool pin) {pinned = pin;}
+    void setProcessorOptions(const ProcessorOptions& opts)
+        {processorOptions = opts;}
+    Telemetry telemetry;
 
 private slots:
     void on_pushButton_clicked();
 
 public slots:
-    void updateHardFaults();
-    void updateSmallFaults();
     void updateLCD();
 
 
@@ -1,8 +1,42 @@
+#include <QObject>
+#include <iostream>
 #include <cstdint>
 #include <vector>
+#include <map>
+#include <thread>
+#include <bitset>
+#include <mutex>
+#include <tuple>
+#include <condition_variable>
+#include "mainwindow.h"
+#include "ControlThread.hpp"
 #include "memorypacket.hpp"
+#include "mux.hpp"
+#include "tile.hpp"
+#include "memory.hpp"
+#include "processor.hpp"
 
 void MemoryPacket::fillBuffer(const uint8_t byte)
 {
 	payload.push_back(byte);
 }
+
+//background packets are carried by their own thread, which must not
+//touch the processor's clock
+void MemoryPacket::waitGlobalTick()
+{
+	if (background) {
+		processorIndex->waitBackgroundTick();
+	} else {
+		processorIndex->waitGlobalTick();
+	}
+}
+
+void MemoryPacket::waitGlobalTicks(const uint64_t& count)
+{
+	if (background) {
+		processorIndex->waitBackgroundTicks(count);
+	} else {
+		processorIndex->waitGlobalTicks(count);
+	}
+}
@@ -12,6 +12,9 @@ private:
 	const uint64_t requestSize;
 	std::vector<uint8_t> payload;
     bool write;
+    bool background;
+    //issue order on the processor, to break ties in arbitration
+    uint64_t sequence;
 	enum direction{OUT, IN} pd;
 
 public:
@@ -19,7 +22,7 @@ public:
 		const uint64_t& localAddr, const uint64_t& sz):
 		processorIndex(processor), remoteAddress(remoteAddr),
         localAddress(localAddr), requestSize(sz),
-        write(false), pd(OUT)
+        write(false), background(false), sequence(0), pd(OUT)
 	{}
 
 	void switchDirection()
@@ -47,6 +50,16 @@ public:
     {write = true;}
     bool getWrite() const
     {return write;}
+    void setBackground()
+    {background = true;}
+    bool getBackground() const
+    {return background;}
+    void setSequence(const uint64_t& seq)
+    {sequence = seq;}
+    uint64_t getSequence() const
+    {return sequence;}
+    void waitGlobalTick();
+    void waitGlobalTicks(const uint64_t& count);
 };
 
 #endif
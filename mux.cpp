@@ -3,6 +3,7 @@
 #include <vector>
 #include <utility>
 #include <tuple>
+#include <algorithm>
 #include <bitset>
 #include <mutex>
 #include <condition_variable>
@@ -18,6 +19,13 @@ using namespace std;
 
 #define WRITE_FACTOR 2
 
+static inline uint64_t burstBeats(const uint64_t& size)
+{
+	if (size <= BURST_BEAT_BYTES) {
+		return 1;
+	}
+	return (size + BURST_BEAT_BYTES - 1) / BURST_BEAT_BYTES;
+}
 
 Mux::~Mux()
 {
@@ -32,6 +40,8 @@ void Mux::disarmMutex()
 	bottomRightMutex = nullptr;
     delete gateMutex;
     gateMutex = nullptr;
+    delete bidMutex;
+    bidMutex = nullptr;
     if (mmuMutex) {
         delete mmuMutex;
         mmuMutex = nullptr;
@@ -45,6 +55,7 @@ void Mux::initialiseMutex()
 	bottomLeftMutex = new mutex();
 	bottomRightMutex = new mutex();
     gateMutex = new mutex();
+    bidMutex = new mutex();
 }
 
 bool Mux::acceptPacketUp(const MemoryPacket& mPack) const
@@ -67,133 +78,166 @@ const tuple<const uint64_t, const uint64_t, const uint64_t,
 		get<0>(lowerRight), get<1>(lowerRight));
 }
 
-void Mux::fillBottomBuffer(bool& buffer, mutex *botMutex,
-	MemoryPacket& packet)
+//wait a tick at a time until an attempt succeeds - blocked packets are
+//counted for the tick
+void Mux::contend(MemoryPacket& packet, const function<bool()>& attempt)
 {
 	while (true) {
-		packet.getProcessor()->waitGlobalTick();
-		botMutex->lock();
-		if (buffer == false) {
-			buffer = true;
-			botMutex->unlock();
+		if (deterministic) {
+			MuxBid bid(&packet, attempt);
+			bidMutex->lock();
+			bids.push_back(&bid);
+			bidMutex->unlock();
+			packet.waitGlobalTick();
+			if (bid.granted) {
+				return;
+			}
+			continue;
+		}
+		packet.waitGlobalTick();
+		if (attempt()) {
 			return;
 		}
-		botMutex->unlock();
 		packet.getProcessor()->incrementBlocks();
 	}
 }
 
-void Mux::routeDown(MemoryPacket& packet)
+//settle the tick's bids here - the side the gate favours first, then
+//by tile and by the order each tile issued its packets
+void Mux::arbitrate()
 {
-	// - this is the alternating implementation
-	// are we left or right?
-	bool packetOnLeft = false;
-	bool *bufferToUnblock = nullptr;
-	const uint64_t processorIndex = packet.getProcessor()->
-		getTile()->getOrder();
-	if (processorIndex < lowerRight.first) {
-		packetOnLeft = true;
+	if (bids.empty()) {
+		return;
 	}
-	bool bothBuffers = false;
-	while (true) {
-		packet.getProcessor()->waitGlobalTick();
-                acceptedMutex->lock();
-                if (acceptedPackets < 4) {
-	 	    bottomLeftMutex->lock();
-		    bottomRightMutex->lock();
-		    if (leftBuffer && rightBuffer) {
-			bothBuffers = true;
-		    } else {
-			bothBuffers = false;
-		    }
-		    if (!bothBuffers) {
-			if (packetOnLeft) {
-        	    		bufferToUnblock = &leftBuffer;
-				bottomRightMutex->unlock();
-				bottomLeftMutex->unlock();
-				gateMutex->lock();
-                                gate = !gate;
-				gateMutex->unlock();
-				goto fillDDR;
-			} else {
-                		bufferToUnblock = &rightBuffer;
-				bottomRightMutex->unlock();
-				bottomLeftMutex->unlock();
-				gateMutex->lock();
-                                gate = !gate;
-				gateMutex->unlock();
-				goto fillDDR;
-			}
-		    }
-		    else {
-			gateMutex->lock();
-			if (gate) {
-				gateMutex->unlock();
-				//prioritise right
-				if (!packetOnLeft) {
-					bufferToUnblock = &rightBuffer;
-					bottomRightMutex->unlock();
-					bottomLeftMutex->unlock();
-					gateMutex->lock();
-					gate = false;
-					gateMutex->unlock();
-					goto fillDDR;
-				}
-			} else {
-				gateMutex->unlock();
-				if (packetOnLeft) {
-					bufferToUnblock = &leftBuffer;
-					bottomRightMutex->unlock();
-					bottomLeftMutex->unlock();
-					gateMutex->lock();
-					gate = true;
-					gateMutex->unlock();
-					goto fillDDR;
-				}
-			}
+	const bool rightFirst = gate;
+	sort(bids.begin(), bids.end(), [this, rightFirst](
+		const MuxBid *a, const MuxBid *b) {
+		const uint64_t tileA = a->packet->getProcessor()->
+			getTile()->getOrder();
+		const uint64_t tileB = b->packet->getProcessor()->
+			getTile()->getOrder();
+		const bool laterA = (tileA > lowerLeft.second) != rightFirst;
+		const bool laterB = (tileB > lowerLeft.second) != rightFirst;
+		return make_tuple(laterA, tileA, a->packet->getSequence()) <
+			make_tuple(laterB, tileB, b->packet->getSequence());
+	});
+	for (auto bid: bids) {
+		bid->granted = bid->attempt();
+		if (!bid->granted) {
+			bid->packet->getProcessor()->incrementBlocks();
 		}
-		bottomRightMutex->unlock();
-		bottomLeftMutex->unlock();
-                }
-                acceptedMutex->unlock();
-		packet.getProcessor()->incrementBlocks();
 	}
+	bids.clear();
+}
 
-fillDDR:
-        bottomLeftMutex->lock();
-        bottomRightMutex->lock();
-        *bufferToUnblock = false;
-        bottomRightMutex->unlock();
-        bottomLeftMutex->unlock();
+bool Mux::tryFillBottom(bool& buffer, mutex *botMutex)
+{
+	lock_guard<mutex> lock(*botMutex);
+	if (buffer == false) {
+		buffer = true;
+		return true;
+	}
+	return false;
+}
+
+void Mux::fillBottomBuffer(bool& buffer, mutex *botMutex,
+	MemoryPacket& packet)
+{
+	contend(packet, [this, &buffer, botMutex]() {
+		return tryFillBottom(buffer, botMutex);
+	});
+}
+
+// - this is the alternating implementation
+bool Mux::tryRouteDown(const bool& packetOnLeft)
+{
+	lock_guard<mutex> accepted(*acceptedMutex);
+	if (acceptedPackets >= PACKET_LIMIT) {
+		return false;
+	}
+	lock_guard<mutex> left(*bottomLeftMutex);
+	lock_guard<mutex> right(*bottomRightMutex);
+	bool *bufferToUnblock = nullptr;
+	bool nextGate = !gate;
+	if (!(leftBuffer && rightBuffer)) {
+		bufferToUnblock = packetOnLeft ? &leftBuffer : &rightBuffer;
+	} else if (gate) {
+		//prioritise right
+		if (!packetOnLeft) {
+			bufferToUnblock = &rightBuffer;
+			nextGate = false;
+		}
+	} else if (packetOnLeft) {
+		bufferToUnblock = &leftBuffer;
+		nextGate = true;
+	}
+	if (bufferToUnblock == nullptr) {
+		return false;
+	}
+	*bufferToUnblock = false;
+	gateMutex->lock();
+	gate = nextGate;
+	gateMutex->unlock();
 	acceptedPackets++;
-        acceptedMutex->unlock();
+	return true;
+}
+
+void Mux::routeDown(MemoryPacket& packet)
+{
+	// are we left or right?
+	const uint64_t processorIndex = packet.getProcessor()->
+		getTile()->getOrder();
+	const bool packetOnLeft = processorIndex < lowerRight.first;
+	contend(packet, [this, packetOnLeft]() {
+		return tryRouteDown(packetOnLeft);
+	});
+
     uint64_t serviceDelay = MMU_DELAY;
     if (packet.getWrite()) {
         serviceDelay *= WRITE_FACTOR;
     }
-    for (unsigned int i = 0; i < serviceDelay; i++) {
-        packet.getProcessor()->incrementServiceTime();
-        packet.getProcessor()->waitGlobalTick();
-    }
+    //first beat is covered by the MMU time, the rest stream from DDR
+    serviceDelay +=
+        (burstBeats(packet.getRequestSize()) - 1) * BURST_BEAT_DELAY;
+    packet.getProcessor()->incrementServiceTime(serviceDelay);
+    packet.waitGlobalTicks(serviceDelay);
     acceptedMutex->lock();
     acceptedPackets--;
     acceptedMutex->unlock();
     //cross to tree
-	for (unsigned int i = 0; i < DDR_DELAY; i++) {
-		packet.getProcessor()->waitGlobalTick();
-	}
-	//get memory
+	packet.waitGlobalTicks(DDR_DELAY);
+	//get memory - straight from the root's memory, as carriers run
+	//apart from their tile; a write carrying its lines stores them
+    const vector<uint8_t> lines = packet.getMemory();
+    if (packet.getWrite() && !lines.empty()) {
+        for (unsigned int i = 0; i < lines.size(); i++) {
+            globalMemory->writeByte(packet.getRemoteAddress() + i,
+                lines[i]);
+        }
+        return;
+    }
     if (packet.getRequestSize() > 0) {
         for (unsigned int i = 0; i < packet.getRequestSize(); i++) {
-            packet.fillBuffer(packet.getProcessor()->
-                getTile()->readByte(packet.getRemoteAddress() + i));
+            packet.fillBuffer(globalMemory->readByte(
+                packet.getRemoteAddress() + i));
         }
     }
     return;
 }	
 
+//write bursts carry their payload up the tree and hold the buffer
+//they have just entered until the last beat has crossed the link
+void Mux::serialiseBurst(MemoryPacket& packet)
+{
+	if (!packet.getWrite()) {
+		return;
+	}
+	packet.waitGlobalTicks(burstBeats(packet.getRequestSize()) - 1);
+}
+
 void Mux::keepRoutingPacket(MemoryPacket& packet)
 {
+	serialiseBurst(packet);
 	if (upstreamMux == nullptr) {
 		return routeDown(packet);
 	} else {
@@ -201,162 +245,56 @@ void Mux::keepRoutingPacket(MemoryPacket& packet)
 	}
 }
 
+//move up into the buffer above - with both our buffers full the gate
+//says which side goes
+bool Mux::tryPostUp(const uint64_t& processorIndex)
+{
+	const bool targetOnRight =
+		processorIndex > upstreamMux->lowerLeft.second;
+	mutex *targetMutex = targetOnRight ? upstreamMux->bottomRightMutex :
+		upstreamMux->bottomLeftMutex;
+	bool& target = targetOnRight ? upstreamMux->rightBuffer :
+		upstreamMux->leftBuffer;
+	lock_guard<mutex> left(*bottomLeftMutex);
+	lock_guard<mutex> right(*bottomRightMutex);
+	bool *source = nullptr;
+	bool nextGate = !gate;
+	if (!(leftBuffer && rightBuffer)) {
+		//only one buffer in use...so our packet has to be there
+		source = leftBuffer ? &leftBuffer : &rightBuffer;
+	} else if (gate) {
+		//prioritise right
+		if (processorIndex > lowerLeft.second) {
+			source = &rightBuffer;
+			nextGate = false;
+		}
+	} else if (processorIndex < lowerRight.first) {
+		source = &leftBuffer;
+	}
+	if (source == nullptr) {
+		return false;
+	}
+	lock_guard<mutex> above(*targetMutex);
+	if (target) {
+		return false;
+	}
+	*source = false;
+	target = true;
+	gateMutex->lock();
+	gate = nextGate;
+	gateMutex->unlock();
+	return true;
+}
+
 void Mux::postPacketUp(MemoryPacket& packet)
 {
 	//one method here allows us to vary priorities between left and right
-	//first step - what is the buffer we are targetting
 	const uint64_t processorIndex = packet.getProcessor()->
 		getTile()->getOrder();
-	mutex *targetMutex = upstreamMux->bottomRightMutex;
-	bool targetOnRight = true;
-	if (processorIndex <= upstreamMux->lowerLeft.second) {
-		targetOnRight = false;
-		targetMutex = upstreamMux->bottomLeftMutex;
-	}
-
-	bool bothBuffers = false;
-	while (true) {
-		packet.getProcessor()->waitGlobalTick();
-        	//in this implementation we alternate 
-		bottomLeftMutex->lock();
-		bottomRightMutex->lock();
-        	if (leftBuffer && rightBuffer) {
-            		bothBuffers = true;
-        	} else {
-			bothBuffers = false;
-		}
-        	if (!bothBuffers) {
-            		//which are we, left or right?
-			//only one buffer in use...so our packet has to be there
-            		if (leftBuffer) {
-                		targetMutex->lock();
-                		if (targetOnRight && upstreamMux->rightBuffer == false)	
-                		{
-                    			leftBuffer = false;
-                    			upstreamMux->rightBuffer = true;
-                    			targetMutex->unlock();
-                    			bottomRightMutex->unlock();
-                    			bottomLeftMutex->unlock();
-                    			gateMutex->lock();
-                                        gate = !gate;
-                    			gateMutex->unlock();
-                    			return upstreamMux->keepRoutingPacket(packet);
-                		}
-                		else if (!targetOnRight && upstreamMux->leftBuffer == false)
-                		{
-                    			leftBuffer = false;
-                    			upstreamMux->leftBuffer = true;
-                    			targetMutex->unlock();
-                    			bottomRightMutex->unlock();
-                    			bottomLeftMutex->unlock();
-                  	  		gateMutex->lock();
-                    			gate = !gate;
-                    			gateMutex->unlock();
-                    			return upstreamMux->keepRoutingPacket(packet);
-                		}
-                		targetMutex->unlock();
-            		} else {
-                    		targetMutex->lock();
-                   	 	if (targetOnRight && upstreamMux->rightBuffer == false)
-                    		{
-                        		rightBuffer = false;
-                        		upstreamMux->rightBuffer = true;
-         	       	        	targetMutex->unlock();
-                	        	bottomRightMutex->unlock();
-                        		bottomLeftMutex->unlock();
-                        		gateMutex->lock();
-                                        gate = !gate;
-                        		gateMutex->unlock();
-                        		return upstreamMux->keepRoutingPacket(packet);
-                    		}
-                    		else if (!targetOnRight && upstreamMux->leftBuffer == false)
-                    		{
-                        		rightBuffer = false;
-                       			upstreamMux->leftBuffer = true;
-                        		targetMutex->unlock();
-                        		bottomRightMutex->unlock();
-                        		bottomLeftMutex->unlock();
-                        		gateMutex->lock();
-                                        gate = !gate;
-                        		gateMutex->unlock();
-                        		return upstreamMux->keepRoutingPacket(packet);
-                    		}
-                    		targetMutex->unlock();
-	    		}
-		} else {
-			//two packets here so which one are we?
-			gateMutex->lock();
-                	if (gate == true) {
-                		gateMutex->unlock();
-                    		//prioritise right
-				if (processorIndex > lowerLeft.second) {
-                    			targetMutex->lock();
-                    			if (targetOnRight &&
-                        			upstreamMux->rightBuffer == false)
-                    			{
-                        			rightBuffer = false;
-                        			upstreamMux->rightBuffer = true;
-                        			targetMutex->unlock();
-        	                		bottomRightMutex->unlock();
-                	        		bottomLeftMutex->unlock();
-                        			gateMutex->lock();
-                        			gate = false;
- 		                       		gateMutex->unlock();
-                	        		return upstreamMux->keepRoutingPacket(packet);
-                	    		}
-                    			else if (!targetOnRight &&
-                        			upstreamMux->leftBuffer == false)
-    	                		{
-        	                		rightBuffer = false;
-                	        		upstreamMux->leftBuffer = true;
-                        			targetMutex->unlock();
-                        			bottomRightMutex->unlock();
-	                        		bottomLeftMutex->unlock();
-        	               			gateMutex->lock();
-                	        		gate = false;
-                        			gateMutex->unlock();
-                        			return upstreamMux->keepRoutingPacket(packet);
-                    			}
-                    			targetMutex->unlock();
-				}
-			} else {
-        	            	gateMutex->unlock();
-                	    	//target left - if we are on the left
-				if (processorIndex < lowerRight.first) {
-					targetMutex->lock();
-		    			if (targetOnRight && upstreamMux->rightBuffer == false)
-                    			{
- 		                       		leftBuffer = false;
-        	                		upstreamMux->rightBuffer = true;
-                	        		targetMutex->unlock();
-                        			bottomRightMutex->unlock();
-                        			bottomLeftMutex->unlock();
- 		                       		gateMutex->lock();
-                	        		gate = !gate;
-                        			gateMutex->unlock();
-                        			return upstreamMux->keepRoutingPacket(packet);
-                    			}
-                    			else if (!targetOnRight &&
-                        			upstreamMux->leftBuffer == false)
-  	                  		{
-        	                		leftBuffer = false;
-                	        		upstreamMux->leftBuffer = true;
-                        			targetMutex->unlock();
-	                        		bottomRightMutex->unlock();
-        	                		bottomLeftMutex->unlock();
-                	        		gateMutex->lock();
-                        			gate = !gate;
-                       				gateMutex->unlock();
-                        			return upstreamMux->keepRoutingPacket(packet);
-                    			}
-					targetMutex->unlock();
-				}
-                	}
-		}
-		bottomRightMutex->unlock();
-		bottomLeftMutex->unlock();
-		packet.getProcessor()->incrementBlocks();
-	}
+	contend(packet, [this, processorIndex]() {
+		return tryPostUp(processorIndex);
+	});
+	return upstreamMux->keepRoutingPacket(packet);
 }
 
 void Mux::routePacket(MemoryPacket& packet)
@@ -371,6 +309,7 @@ void Mux::routePacket(MemoryPacket& packet)
 		fillBottomBuffer(rightBuffer, bottomRightMutex,
 			packet);
 	}
+	serialiseBurst(packet);
 	return postPacketUp(packet);
 }
 
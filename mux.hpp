@@ -1,15 +1,34 @@
 
 #ifndef _MUX_CLASS_
 #define _MUX_CLASS_
+#include <vector>
+#include <functional>
 
 
 //8 ticks plus MMU time
 static const uint64_t MMU_DELAY = 50;
 static const uint64_t DDR_DELAY = 8;
 static const uint64_t PACKET_LIMIT = 4;
+//bursts: bytes moved per tick on a tree link, and extra DDR ticks per beat
+static const uint64_t BURST_BEAT_BYTES = 16;
+static const uint64_t BURST_BEAT_DELAY = 2;
+//no request through the tree is answered sooner than this, so a tile
+//may run this far ahead of the barrier on purely local work
+static const uint64_t LOOKAHEAD_QUANTUM = MMU_DELAY + DDR_DELAY;
 
 class Memory;
 
+//a packet's attempt on a buffer - under deterministic arbitration the
+//attempts of a tick are made for them, in canonical order, as it closes
+class MuxBid {
+public:
+	MemoryPacket *packet;
+	std::function<bool()> attempt;
+	bool granted;
+	MuxBid(MemoryPacket *pack, const std::function<bool()>& fn):
+		packet(pack), attempt(fn), granted(false) {}
+};
+
 class Mux {
 private:
 	Memory* globalMemory;
@@ -22,10 +41,18 @@ private:
     std::mutex *mmuMutex;
         std::unique_lock<std::mutex> mmuLock;
 	void disarmMutex();
+	void serialiseBurst(MemoryPacket& packet);
     std::mutex *gateMutex;
     std::mutex *acceptedMutex;
     bool gate;
     uint64_t acceptedPackets;
+    bool deterministic;
+    std::mutex *bidMutex;
+    std::vector<MuxBid *> bids;
+    void contend(MemoryPacket& packet, const std::function<bool()>& attempt);
+    bool tryFillBottom(bool& buffer, std::mutex *botMutex);
+    bool tryRouteDown(const bool& packetOnLeft);
+    bool tryPostUp(const uint64_t& processorIndex);
 
 public:
 	Mux* upstreamMux;
@@ -34,7 +61,8 @@ public:
 	Mux():  leftBuffer(false), rightBuffer(false), 
             bottomLeftMutex(nullptr), bottomRightMutex(nullptr),
             mmuMutex(nullptr), gateMutex(nullptr), acceptedMutex(nullptr),
-	    acceptedPackets(0), gate(false),
+	    acceptedPackets(0), gate(false), deterministic(false),
+            bidMutex(nullptr),
             upstreamMux(nullptr), downstreamMuxLow(nullptr),
             downstreamMuxHigh(nullptr)  {};
 	Mux(Memory *gMem): globalMemory(gMem) {};
@@ -54,6 +82,8 @@ public:
 	void postPacketUp(MemoryPacket& packet);
 	void keepRoutingPacket(MemoryPacket& packet);
     void addMMUMutex();
+    void setDeterministic(const bool det) { deterministic = det; }
+    void arbitrate();
 
 };	
 #endif
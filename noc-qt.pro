@@ -39,6 +39,7 @@ HEADERS  += mainwindow.h \
     paging.hpp \
     processor.hpp \
     SAX2Handler.hpp \
+    storebuffer.hpp \
     xmlFunctor.hpp \
     tile.hpp \
     tree.hpp
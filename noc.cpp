@@ -4,6 +4,7 @@
 #include <utility>
 #include <vector>
 #include <map>
+#include <deque>
 #include <string>
 #include <cstdlib>
 #include <thread>
@@ -35,20 +36,32 @@ using namespace std;
 using namespace xercesc;
 
 Noc::Noc(const long columns, const long rows, const long pageShift,
-    const uint64_t bSize, MainWindow* pWind, const long blocks):
+    const long lineShift, const uint64_t bSize, const uint64_t localMemory,
+    const map<long, uint64_t>& tileMemory, MainWindow* pWind,
+    const long blocks, const SimulationEngine eng,
+    const unsigned long workerThreads, const bool canonical,
+    const bool pinThreads, const ProcessorOptions& processorOptions):
     columnCount(columns), rowCount(rows),
-    blockSize(bSize), mainWindow(pWind), memoryBlocks(blocks)
+    blockSize(bSize), mainWindow(pWind), engine(eng), workers(workerThreads),
+    deterministic(canonical), pinned(pinThreads), memoryBlocks(blocks)
 {
     uint64_t number = 0;
     for (int i = 0; i < columns; i++) {
 		tiles.push_back(vector<Tile *>(rows));
 		for (int j = 0; j < rows; j++) {
+			//overrides are by tile order, as reported
+			uint64_t memorySize = localMemory;
+			auto override = tileMemory.find(j * columns + i);
+			if (override != tileMemory.end()) {
+				memorySize = override->second;
+			}
     		        tiles[i][j] = new Tile(
-				this, i, j, pageShift, mainWindow, number++);
+				this, i, j, pageShift, lineShift, memorySize,
+				mainWindow, number++, processorOptions);
 		}
 	}
 	//construct non-memory network
-	//NB currently not used
+	//carries read-only page copies between tiles
 	for (int i = 0; i < columns; i++) {
 		for (int j = 0; j < (rows - 1); j++) {
 			tiles[i][j]->addConnection(i, j + 1);
@@ -263,19 +276,28 @@ long Noc::executeInstructions()
 
 	ptrBasePageTables = createBasicPageTables();
 
-	pBarrier = new ControlThread(0, mainWindow);
+	pBarrier = new ControlThread(0, mainWindow, columnCount * rowCount,
+		engine, workers);
+	if (deterministic) {
+		pBarrier->setArbiter([this]() { arbitrate(); });
+	}
+	if (pinned) {
+		pBarrier->pinThreads();
+	}
 	vector<thread *> threads;
 
 	for (int i = 0; i < columnCount * rowCount; i++) {
 		XMLFunctor xmlFunc(tileAt(i));
-		//spawn a thread per tile
-		threads.push_back(new thread(xmlFunc));
-		pBarrier->incrementTaskCount();
-		
+		//a thread per tile, or a coroutine under the event engine
+		threads.push_back(pBarrier->launch(i, xmlFunc,
+			TILE_STACK_BYTES));
 	}
 	pBarrier->begin();
 	for (int i = 0; i < columnCount * rowCount; i++) {
-		threads[i]->join();
+		if (threads[i]) {
+			threads[i]->join();
+			delete threads[i];
+		}
 	}
 	delete pBarrier;
 	pBarrier = nullptr;
@@ -286,3 +308,112 @@ ControlThread* Noc::getBarrier()
 {
 	return pBarrier;
 }
+
+//note lines of a read-only page a tile holds a copy of
+void Noc::shareLines(const unsigned long order, const uint64_t page,
+	const uint64_t firstLine, const uint64_t lines,
+	const uint64_t linesPerPage)
+{
+	const SharingUpdate update = {order, page, firstLine, lines,
+		linesPerPage, true};
+	lock_guard<mutex> lock(sharedMutex);
+	if (deterministic) {
+		sharingUpdates.push_back(update);
+	} else {
+		applySharing(update);
+	}
+}
+
+void Noc::unsharePage(const unsigned long order, const uint64_t page)
+{
+	const SharingUpdate update = {order, page, 0, 0, 0, false};
+	lock_guard<mutex> lock(sharedMutex);
+	if (deterministic) {
+		sharingUpdates.push_back(update);
+	} else {
+		applySharing(update);
+	}
+}
+
+//each tile only changes its own entries, so updates from different
+//tiles may be applied in any order
+void Noc::applySharing(const SharingUpdate& update)
+{
+	if (update.share) {
+		vector<bool>& held = sharedPages[update.page][update.order];
+		if (held.empty()) {
+			held.assign(update.linesPerPage, false);
+		}
+		for (uint64_t i = 0; i < update.lines; i++) {
+			held[update.firstLine + i] = true;
+		}
+		return;
+	}
+	auto holders = sharedPages.find(update.page);
+	if (holders == sharedPages.end()) {
+		return;
+	}
+	holders->second.erase(update.order);
+	if (holders->second.empty()) {
+		sharedPages.erase(holders);
+	}
+}
+
+//close of a tick under deterministic arbitration - nobody else is
+//running
+void Noc::arbitrate()
+{
+	for (auto& update: sharingUpdates) {
+		applySharing(update);
+	}
+	sharingUpdates.clear();
+	for (auto tree: trees) {
+		tree->arbitrate();
+	}
+}
+
+//hops to the nearest other tile holding all the lines asked for,
+//searched breadth first over the mesh links - -1 if none in range
+long Noc::findSharer(const unsigned long order, const uint64_t page,
+	const uint64_t firstLine, const uint64_t lines,
+	const uint64_t maxHops)
+{
+	lock_guard<mutex> lock(sharedMutex);
+	auto holders = sharedPages.find(page);
+	if (holders == sharedPages.end()) {
+		return -1;
+	}
+	vector<long> hops(columnCount * rowCount, -1);
+	deque<unsigned long> frontier;
+	hops[order] = 0;
+	frontier.push_back(order);
+	while (!frontier.empty()) {
+		const unsigned long here = frontier.front();
+		frontier.pop_front();
+		auto holder = holders->second.find(here);
+		if (hops[here] > 0 && holder != holders->second.end()) {
+			bool allHeld = true;
+			for (uint64_t i = 0; i < lines; i++) {
+				if (!holder->second[firstLine + i]) {
+					allHeld = false;
+					break;
+				}
+			}
+			if (allHeld) {
+				return hops[here];
+			}
+		}
+		if (static_cast<uint64_t>(hops[here]) == maxHops) {
+			continue;
+		}
+		for (auto& link: tileAt(here)->getConnections()) {
+			const unsigned long next =
+				link.second * columnCount + link.first;
+			if (hops[next] < 0) {
+				hops[next] = hops[here] + 1;
+				frontier.push_back(next);
+			}
+		}
+	}
+	return -1;
+}
@@ -6,6 +6,18 @@ class Tree;
 class PageTable;
 #include "mainwindow.h"
 
+//a change to the sharing map - held back to the close of the tick when
+//arbitration is deterministic, so every query on a tick sees the same map
+class SharingUpdate {
+public:
+	unsigned long order;
+	uint64_t page;
+	uint64_t firstLine;
+	uint64_t lines;
+	uint64_t linesPerPage;
+	bool share;
+};
+
 class Noc {
 
 #define APNUMBERSIZE 8
@@ -22,14 +34,31 @@ private:
 	unsigned long scanLevelFourTable(unsigned long addr);
 	ControlThread *pBarrier;
 	std::vector<Memory> globalMemory;
+	//read-only pages held in local memories: global page address to
+	//the tiles holding it and the lines each has
+	std::map<uint64_t, std::map<unsigned long, std::vector<bool> > >
+		sharedPages;
+	std::mutex sharedMutex;
+	std::vector<SharingUpdate> sharingUpdates;
+	void applySharing(const SharingUpdate& update);
     	MainWindow *mainWindow;
+	const SimulationEngine engine;
+	const unsigned long workers;
+	const bool deterministic;
+	const bool pinned;
 
 public:
 	std::vector<Memory>& getGlobal() { return globalMemory;}
 	const long memoryBlocks;
 	std::vector<Tree *> trees;
 	Noc(const long columns, const long rows, const long pageShift,
-        const uint64_t bSize, MainWindow *pWind, const long memBlocks);
+        const long lineShift, const uint64_t bSize,
+        const uint64_t localMemory,
+        const std::map<long, uint64_t>& tileMemory, MainWindow *pWind,
+        const long memBlocks, const SimulationEngine eng,
+        const unsigned long workerThreads = 1,
+        const bool canonical = false, const bool pinThreads = false,
+        const ProcessorOptions& processorOptions = ProcessorOptions());
 	~Noc();
 	Tile* tileAt(long i);
 	long executeInstructions();
@@ -37,6 +66,15 @@ public:
     	long getColumnCount() const { return columnCount;}
     	long getRowCount() const { return rowCount; }
 	ControlThread *getBarrier();
+	bool isDeterministic() const { return deterministic; }
+	void arbitrate();
+	void shareLines(const unsigned long order, const uint64_t page,
+		const uint64_t firstLine, const uint64_t lines,
+		const uint64_t linesPerPage);
+	void unsharePage(const unsigned long order, const uint64_t page);
+	long findSharer(const unsigned long order, const uint64_t page,
+		const uint64_t firstLine, const uint64_t lines,
+		const uint64_t maxHops);
 };
 
 #endif
@@ -38,37 +38,143 @@
 const static uint64_t KERNELPAGES = 2;	//2 gives 1k kernel on 512b paging
 const static uint64_t STACKPAGES = 2; 	//2 gives 1k stack on 512b paging
 const static uint64_t BITMAPDELAY = 0;	//0 for subcycle bitmap checks
-const static uint64_t FREEPAGES = 25;	//25 for 512b pages, 12 for 1k pages
-const static uint64_t BASEPAGES = 5;	//5 for 512b pages, 3 for 1k pages 
 
 using namespace std;
 
-Processor::Processor(Tile *parent, MainWindow *mW, uint64_t numb):
-    masterTile(parent), mode(REAL), mainWindow(mW)
+Processor::Processor(Tile *parent, MainWindow *mW, uint64_t numb,
+	const ProcessorOptions& opts):
+    masterTile(parent), mode(REAL), mainWindow(mW), options(opts)
 {
 	registerFile = vector<uint64_t>(REGISTER_FILE_SIZE, 0);
+	shadowRegisters = vector<uint64_t>(REGISTER_FILE_SIZE, 0);
+	contextRegisters = vector<vector<uint64_t>>(options.contexts,
+		vector<uint64_t>(REGISTER_FILE_SIZE, 0));
+	contextStats = vector<ContextStats>(options.contexts);
+	currentASID = 0;
+	pinnedFrames = 0;
 	statusWord[0] = true;
 	totalTicks = 1;
+	lead = 0;
+	routingDepth = 0;
+	packetsIssued = 0;
+	aheadWake = 0;
 	currentTLB = 0;
 	hardFaultCount = 0;
 	smallFaultCount = 0;
     	blocks = 0;
+	cleanLinesSkipped = 0;
+	dirtyLinesWritten = 0;
+	burstsWritten = 0;
+	linesFetched = 0;
+	fetchWidenings = 0;
+	fetchNarrowings = 0;
+	prefetchLines = 0;
+	prefetchHits = 0;
+	demandMisses = 0;
+	linesCleaned = 0;
+	cleanVictims = 0;
+	mshrOccupancy = 0;
+	mshrSamples = 0;
+	mshrPeak = 0;
+	mshrMerges = 0;
+	mshrFullStalls = 0;
+	storesBuffered = 0;
+	storesMerged = 0;
+	storeForwards = 0;
+	storeDrains = 0;
+	storesRetiredIdle = 0;
+	streamHits = 0;
+	streamMisses = 0;
+	streamLate = 0;
+	streamFlushes = 0;
+	handlerTicks = 0;
+	saveTicks = 0;
+	tableWalks = 0;
+	walkProbes = 0;
+	walkFallbacks = 0;
+	contextSwitches = 0;
+	tlbFlushes = 0;
+	pinsRefused = 0;
+	meshQueries = 0;
+	meshHits = 0;
+	meshHops = 0;
+	aheadWindows = 0;
+	aheadTicks = 0;
+	aheadDeepest = 0;
+	aheadDepth = 0;
+	aheadSamples = 0;
+	cleanerHand = 0;
+	mshrsInUse = 0;
+	draining = false;
+	streamNextLine = 0;
+	savingRegisters = false;
+	hashOverflows = 0;
+	tickMark = totalTicks;
+	cleanerDue = false;
+	serviceTime = 0;
+	lastPrefetchLine = 0;
+	prefetchStride = 0;
+	prefetchConfidence = 0;
         randomPage = 7;
 	inInterrupt = false;
     	processorNumber = numb;
     	clockDue = false;
-    	QObject::connect(this, SIGNAL(hardFault()),
-        	mW, SLOT(updateHardFaults()));
-    	QObject::connect(this, SIGNAL(smallFault()),
-        	mW, SLOT(updateSmallFaults()));
+    	mainWindow->telemetry.enrol(&faults);
+}
+
+Processor::~Processor()
+{
+	mainWindow->telemetry.withdraw(&faults);
 }
 
 void Processor::resetCounters()
 {
+	accountContext();
 	hardFaultCount = 0;
 	smallFaultCount = 0;
 	blocks = 0;
 	serviceTime = 0;
+	cleanLinesSkipped = 0;
+	dirtyLinesWritten = 0;
+	burstsWritten = 0;
+	linesFetched = 0;
+	fetchWidenings = 0;
+	fetchNarrowings = 0;
+	prefetchLines = 0;
+	prefetchHits = 0;
+	demandMisses = 0;
+	linesCleaned = 0;
+	cleanVictims = 0;
+	mshrOccupancy = 0;
+	mshrSamples = 0;
+	mshrPeak = 0;
+	mshrMerges = 0;
+	mshrFullStalls = 0;
+	storesBuffered = 0;
+	storesMerged = 0;
+	storeForwards = 0;
+	storeDrains = 0;
+	storesRetiredIdle = 0;
+	streamHits = 0;
+	streamMisses = 0;
+	streamLate = 0;
+	streamFlushes = 0;
+	handlerTicks = 0;
+	saveTicks = 0;
+	tableWalks = 0;
+	walkProbes = 0;
+	walkFallbacks = 0;
+	contextSwitches = 0;
+	tlbFlushes = 0;
+	pinsRefused = 0;
+	meshQueries = 0;
+	meshHits = 0;
+	meshHops = 0;
+	aheadWindows = 0;
+	aheadTicks = 0;
+	aheadDeepest = 0;
+	aheadDepth = 0;
+	aheadSamples = 0;
 }
 
 void Processor::setMode()
@@ -134,11 +240,11 @@ void Processor::writeOutBasicPageEntries(const uint64_t& pagesAvailable)
 }
 
 void Processor::markUpBasicPageEntries(const uint64_t& reqPTEPages,
-	const uint64_t& reqBitmapPages)
+	const uint64_t& reqBitmapPages, const uint64_t& reqHashPages)
 {
-	//mark for page tables, bit map and 2 notional page for kernel
-	for (unsigned int i = 0;
-			i < (reqPTEPages + reqBitmapPages + KERNELPAGES); i++) {
+	//mark for page tables, bit map, hash and 2 notional page for kernel
+	for (unsigned int i = 0; i < (reqPTEPages + reqBitmapPages +
+		reqHashPages + KERNELPAGES); i++) {
 		const uint64_t pageEntryBase = (1 << pageShift) * KERNELPAGES +
 			i * PAGETABLEENTRY + PAGESLOCAL;
 		const uint64_t mappingAddress = PAGESLOCAL +
@@ -150,7 +256,7 @@ void Processor::markUpBasicPageEntries(const uint64_t& reqPTEPages,
 		masterTile->writeWord32(pageEntryBase + FLAGOFFSET, 0x07);
 	}
 	//stack
-    	uint64_t stackFrame = (TILE_MEM_SIZE >> pageShift) - 1;
+    	uint64_t stackFrame = pagesAvailable - 1;
 	uint64_t stackInTable = (1 << pageShift) * KERNELPAGES + 
         	stackFrame * PAGETABLEENTRY + PAGESLOCAL;
 	for (unsigned int i = 0; i < STACKPAGES; i++) {
@@ -166,6 +272,11 @@ void Processor::markUpBasicPageEntries(const uint64_t& reqPTEPages,
 
 void Processor::flushPagesStart()
 {
+    fence();
+    //let background fetches land before pages go
+    while (!backgroundFetches.empty()) {
+        waitATick();
+    }
     interruptBegin();
 }
 
@@ -175,10 +286,13 @@ void Processor::flushPagesEnd()
 }
 
 
-void Processor::createMemoryMap(Memory *local, long pShift)
+void Processor::createMemoryMap(Memory *local, long pShift, long lShift)
 {
 	localMemory = local;
 	pageShift = pShift;
+	bitmapShift = lShift;
+	bitmapBytes = 1 << bitmapShift;
+	bitmapMask = ~(bitmapBytes - 1);
 	memoryAvailable = localMemory->getSize();
 	pagesAvailable = memoryAvailable >> pageShift;
 	uint64_t requiredPTESize = pagesAvailable * PAGETABLEENTRY;
@@ -187,67 +301,242 @@ void Processor::createMemoryMap(Memory *local, long pShift)
 		requiredPTEPages++;
 	}
 
-	stackPointer = TILE_MEM_SIZE + PAGESLOCAL;
+	stackPointer = memoryAvailable + PAGESLOCAL;
 	stackPointerUnder = stackPointer;
 	stackPointerOver = stackPointer - (STACKPAGES << pageShift);
 
 	zeroOutTLBs(pagesAvailable);
+	//every frame starts fetching single lines
+	fetchShift = vector<uint64_t>(pagesAvailable, bitmapShift);
+	lastFaultOffset = vector<uint64_t>(pagesAvailable, ~0ULL);
+	adjacentFaults = vector<uint64_t>(pagesAvailable, 0);
+	prefetchedLines = vector<vector<bool>>(pagesAvailable,
+		vector<bool>((1 << pageShift) >> bitmapShift, false));
 
 	//how many pages needed for bitmaps?
-	uint64_t bitmapSize = ((1 << pageShift) / (BITMAP_BYTES)) / 8;
-	uint64_t totalBitmapSpace = bitmapSize * pagesAvailable;
+	//presence bitmaps for every frame, followed by the dirty bitmaps
+	//a frame's bitmap always takes at least a whole byte
+	const uint64_t linesPerPage = (1 << pageShift) >> bitmapShift;
+	bitmapSizeBytes = linesPerPage / BITS_PER_BYTE;
+	if (bitmapSizeBytes == 0) {
+		bitmapSizeBytes = 1;
+	}
+	uint64_t totalBitmapSpace = 2 * bitmapSizeBytes * pagesAvailable;
 	uint64_t requiredBitmapPages = totalBitmapSpace >> pageShift;
 	if ((requiredBitmapPages << pageShift) != totalBitmapSpace) {
 		requiredBitmapPages++;
 	}
+	//hash slots follow the bitmaps - at least twice as many as frames
+	uint64_t requiredHashPages = 0;
+	hashSlots = 1;
+	if (options.hashedPageTable) {
+		while (hashSlots < 2 * pagesAvailable) {
+			hashSlots <<= 1;
+		}
+		const uint64_t hashSpace = hashSlots * sizeof(uint64_t);
+		requiredHashPages = hashSpace >> pageShift;
+		if ((requiredHashPages << pageShift) != hashSpace) {
+			requiredHashPages++;
+		}
+	}
+	hashTableOffset = (KERNELPAGES + requiredPTEPages +
+		requiredBitmapPages) * (1 << pageShift);
 	writeOutPageAndBitmapLengths(requiredPTEPages, requiredBitmapPages);
 	writeOutBasicPageEntries(pagesAvailable);
-	markUpBasicPageEntries(requiredPTEPages, requiredBitmapPages);
+	markUpBasicPageEntries(requiredPTEPages, requiredBitmapPages,
+		requiredHashPages);
 	pageMask = 0xFFFFFFFFFFFFFFFF;
 	pageMask = pageMask >> pageShift;
 	pageMask = pageMask << pageShift;
 	bitMask = ~ pageMask;
-	uint64_t pageCount =
-		requiredPTEPages + requiredBitmapPages + KERNELPAGES;
+	uint64_t pageCount = requiredPTEPages + requiredBitmapPages +
+		requiredHashPages + KERNELPAGES;
+	//frames left to page into sit between the tables and the stack
+	basePages = pageCount;
+	//pins never take the last of these - applyPin refuses them
+	if (pagesAvailable <= basePages + STACKPAGES) {
+		cerr << "Local memory of " << memoryAvailable;
+		cerr << " bytes leaves no frames to page into." << endl;
+		exit(EXIT_FAILURE);
+	}
+	freePages = pagesAvailable - basePages - STACKPAGES;
 	for (unsigned int i = 0; i <= pageCount; i++) {
 		const uint64_t pageStart =
 			PAGESLOCAL + i * (1 << pageShift);
 		fixTLB(i, pageStart);
-        	for (unsigned int j = 0; j < bitmapSize * BITS_PER_BYTE; j++) {
-			markBitmapInit(i, pageStart + j * BITMAP_BYTES);
+        	for (unsigned int j = 0; j < linesPerPage; j++) {
+			markBitmapInit(i, pageStart + j * bitmapBytes);
 		}
 	}
 	//TLB and bitmap for stack
-	uint64_t stackPage = PAGESLOCAL + TILE_MEM_SIZE; 
+	uint64_t stackPage = PAGESLOCAL + memoryAvailable;
 	uint64_t stackPageNumber = pagesAvailable;
 	for (unsigned int i = 0; i < STACKPAGES; i++) {
 		stackPageNumber--;
 		stackPage -= (1 << pageShift);
 		fixTLB(stackPageNumber, stackPage);
-		for (unsigned int i = 0; i < bitmapSize * BITS_PER_BYTE; i++) {
+		for (unsigned int i = 0; i < linesPerPage; i++) {
 			markBitmapInit(stackPageNumber, stackPage +
-				i * BITMAP_BYTES);
+				i * bitmapBytes);
 		}
 	}
+	//hash every entry marked up so far
+	if (options.hashedPageTable) {
+		for (uint64_t i = 0; i < hashSlots; i++) {
+			localMemory->writeLong(hashTableOffset +
+				i * sizeof(uint64_t), HASH_EMPTY);
+		}
+		for (uint64_t i = 0; i < pagesAvailable; i++) {
+			const uint64_t pte = (1 << pageShift) * KERNELPAGES +
+				i * PAGETABLEENTRY;
+			if (localMemory->readWord32(pte + FLAGOFFSET) & 0x01) {
+				hashInsert(localMemory->readLong(pte + VOFFSET),
+					i, false);
+			}
+		}
+	}
+}
+
+uint64_t Processor::hashSlot(const uint64_t& pageAddress,
+	const uint64_t& probe) const
+{
+	const uint64_t hash = ((pageAddress >> pageShift) *
+		0x9E3779B97F4A7C15ULL) >> 32;
+	return hashTableOffset +
+		((hash + probe) & (hashSlots - 1)) * sizeof(uint64_t);
+}
+
+//fixed cost walk - a read of the slot and a read of the entry it
+//names for each probe, stopping at an empty slot
+bool Processor::hashLookup(const uint64_t& pageAddress, uint64_t& frameNo)
+{
+	for (uint64_t i = 0; i < HASH_PROBES; i++) {
+		waitATick();
+		walkProbes++;
+		const uint64_t slot =
+			localMemory->readLong(hashSlot(pageAddress, i));
+		if (slot == HASH_EMPTY) {
+			return false;
+		}
+		if (slot == HASH_TOMBSTONE) {
+			continue;
+		}
+		const uint64_t pte = (1 << pageShift) * KERNELPAGES +
+			(slot - 1) * PAGETABLEENTRY;
+		waitATick();
+		if ((localMemory->readWord32(pte + FLAGOFFSET) & 0x01) &&
+			localMemory->readLong(pte + VOFFSET) == pageAddress) {
+			frameNo = slot - 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+//linear probing - entries beyond HASH_PROBES cannot be found by the
+//walker so they are counted and the walk falls back to a scan
+void Processor::hashInsert(const uint64_t& pageAddress,
+	const uint64_t& frameNo, const bool& timed)
+{
+	for (uint64_t i = 0; i < hashSlots; i++) {
+		if (timed) {
+			waitATick();
+		}
+		const uint64_t slotAddress = hashSlot(pageAddress, i);
+		const uint64_t slot = localMemory->readLong(slotAddress);
+		if (slot != HASH_EMPTY && slot != HASH_TOMBSTONE) {
+			continue;
+		}
+		localMemory->writeLong(slotAddress, frameNo + 1);
+		if (i >= HASH_PROBES) {
+			hashOverflows++;
+		}
+		return;
+	}
+}
+
+void Processor::hashRemove(const uint64_t& pageAddress,
+	const uint64_t& frameNo, const bool& timed)
+{
+	for (uint64_t i = 0; i < hashSlots; i++) {
+		if (timed) {
+			waitATick();
+		}
+		const uint64_t slotAddress = hashSlot(pageAddress, i);
+		const uint64_t slot = localMemory->readLong(slotAddress);
+		if (slot == HASH_EMPTY) {
+			return;
+		}
+		if (slot != frameNo + 1) {
+			continue;
+		}
+		localMemory->writeLong(slotAddress, HASH_TOMBSTONE);
+		if (i >= HASH_PROBES) {
+			hashOverflows--;
+		}
+		return;
+	}
+}
+
+//find the frame holding a page after a TLB miss
+bool Processor::walkPageTable(const uint64_t& pageSought, uint64_t& frameNo)
+{
+	tableWalks++;
+	if (options.hashedPageTable) {
+		if (hashLookup(pageSought, frameNo)) {
+			return true;
+		}
+		if (hashOverflows == 0) {
+			return false;
+		}
+		walkFallbacks++;
+	}
+	for (unsigned int i = 0; i < pagesAvailable; i++) {
+		waitATick();
+		uint64_t addressInPageTable = PAGESLOCAL +
+			(i * PAGETABLEENTRY) + (1 << pageShift) * KERNELPAGES;
+		uint64_t flags =
+			masterTile->readWord32(addressInPageTable + FLAGOFFSET);
+		if (!(flags & 0x01)) {
+			continue;
+		}
+		waitATick();
+		uint64_t storedPage =
+			masterTile->readLong(addressInPageTable + VOFFSET);
+		waitATick();
+		if (pageSought == storedPage) {
+			frameNo = i;
+			return true;
+		}
+		waitATick();
+	}
+	return false;
 }
 
 bool Processor::isBitmapValid(const uint64_t& address,
 	const uint64_t& physAddress) const
 {
 	const uint64_t pageTablePages = masterTile->readLong(PAGESLOCAL);
-	const uint64_t bitmapSize = (1 << pageShift) / (BITMAP_BYTES * 8);
 	const uint64_t bitmapOffset = (KERNELPAGES + pageTablePages) * (1 << pageShift);
-	uint64_t bitToCheck = ((address & bitMask) / BITMAP_BYTES);
+	uint64_t bitToCheck = ((address & bitMask) >> bitmapShift);
 	const uint64_t bitToCheckOffset = bitToCheck / 8;
 	bitToCheck %= 8;
 	const uint64_t frameNo =
 		(physAddress - PAGESLOCAL) >> pageShift;
 	const uint8_t bitFromBitmap = 
 		masterTile->readByte(PAGESLOCAL + bitmapOffset +
-		frameNo * bitmapSize + bitToCheckOffset);
+		frameNo * bitmapSizeBytes + bitToCheckOffset);
 	return bitFromBitmap & (1 << bitToCheck);
 }
 
+//dirty bitmaps sit directly after the presence bitmaps of every frame
+uint64_t Processor::dirtyBitmapOffset() const
+{
+	const uint64_t pageTablePages = masterTile->readLong(PAGESLOCAL);
+	return (KERNELPAGES + pageTablePages) * (1 << pageShift) +
+		pagesAvailable * bitmapSizeBytes;
+}
+
 uint64_t Processor::generateAddress(const uint64_t& frame,
 	const uint64_t& address) 
 {
@@ -258,28 +547,47 @@ uint64_t Processor::generateAddress(const uint64_t& frame,
 
 void Processor::interruptBegin()
 {
-	interruptLock.lock();
+	//buffered stores reach memory before the handler runs
+	drainStoreBuffer();
 	inInterrupt = true;
+	savingRegisters = true;
 	switchModeReal();
-	for (auto i: registerFile) {
-		waitATick();
-		pushStackPointer();	
+	if (options.interruptSave == SAVE_SHADOW) {
+		//bank switch
 		waitATick();
-		masterTile->writeLong(stackPointer, i);
+		registerFile.swap(shadowRegisters);
+	} else {
+		const uint64_t toSave = (options.interruptSave == SAVE_LAZY) ?
+			HANDLER_REGISTERS : registerFile.size();
+		for (uint64_t i = 0; i < toSave; i++) {
+			waitATick();
+			pushStackPointer();
+			waitATick();
+			masterTile->writeLong(stackPointer, registerFile[i]);
+		}
 	}
+	savingRegisters = false;
 }
 
 void Processor::interruptEnd()
 {
-	for (int i = registerFile.size() - 1; i >= 0; i--) {
+	savingRegisters = true;
+	if (options.interruptSave == SAVE_SHADOW) {
 		waitATick();
-		registerFile[i] = masterTile->readLong(stackPointer);
-		waitATick();
-		popStackPointer();
+		registerFile.swap(shadowRegisters);
+	} else {
+		const int toRestore = (options.interruptSave == SAVE_LAZY) ?
+			HANDLER_REGISTERS : registerFile.size();
+		for (int i = toRestore - 1; i >= 0; i--) {
+			waitATick();
+			registerFile[i] = masterTile->readLong(stackPointer);
+			waitATick();
+			popStackPointer();
+		}
 	}
+	savingRegisters = false;
 	switchModeVirtual();
 	inInterrupt = false;
-	interruptLock.unlock();
 }
 
 //tuple - vector of bytes, size of vector, success
@@ -288,15 +596,19 @@ const vector<uint8_t> Processor::requestRemoteMemory(
 	const uint64_t& size, const uint64_t& remoteAddress,
 	const uint64_t& localAddress, const bool& write)
 {
-	//assemble request
-	MemoryPacket memoryRequest(this, remoteAddress,
+	//assemble request - global memory is not tagged
+	MemoryPacket memoryRequest(this, remoteAddress & ~ASID_MASK,
 		localAddress, size);
 	if (write) {
 		memoryRequest.setWrite();
 	}
+	memoryRequest.setSequence(packetsIssued++);
+	synchronise();
 	//wait for response
 	if (masterTile->treeLeaf->acceptPacketUp(memoryRequest)) {
+		routingDepth++;
 		masterTile->treeLeaf->routePacket(memoryRequest);
+		routingDepth--;
 	} else {
 		cerr << "FAILED" << endl;
 		exit(1);
@@ -309,7 +621,7 @@ void Processor::transferGlobalToLocal(const uint64_t& address,
 	const uint64_t& size)
 {
 	//mimic a DMA call - so need to advance PC
-	uint64_t maskedAddress = address & BITMAP_MASK;
+	uint64_t maskedAddress = address & bitmapMask;
 	int offset = 0;
 	vector<uint8_t> answer = requestRemoteMemory(size,
 		maskedAddress, get<1>(tlbEntry) +
@@ -327,24 +639,698 @@ void Processor::transferLocalToGlobal(const uint64_t& address,
 {
 	//again - this is like a DMA call, there is a delay, but no need
 	//to advance the PC
-	uint64_t maskedAddress = address & BITMAP_MASK;
+	uint64_t maskedAddress = address & bitmapMask;
 	//make the call - ignore the results
-	requestRemoteMemory(size, get<0>(tlbEntry), maskedAddress, true);
+	requestRemoteMemory(size, get<0>(tlbEntry) + (maskedAddress & bitMask),
+		maskedAddress, true);
+}
+
+uint64_t Processor::triggerSmallFault(
+	const tuple<uint64_t, uint64_t, bool>& tlbEntry,
+	const uint64_t& address, const bool& write, const bool& readOnly,
+	const bool& load)
+{
+	//buffered stores go before the fault handler - they may move
+	//this page, so look the address up again afterwards
+	if (!storeBuffer.empty() && !draining) {
+		drainStoreBuffer();
+		if (write) {
+			return fetchAddressWrite(address);
+		}
+		return fetchAddressRead(address, readOnly, false, load);
+	}
+	const uint64_t frameNo =
+		(get<1>(tlbEntry) - PAGESLOCAL) >> pageShift;
+	//line already on its way - wait for it rather than fetch again;
+	//the stream buffer only fills a line when it is taken
+	if (backgroundFetchPending(frameNo, address)) {
+		if (!streamBufferHit(address)) {
+			while (backgroundFetchPending(frameNo, address)) {
+				waitATick();
+			}
+		}
+		if (isBitmapValid(address, get<1>(tlbEntry))) {
+			notePrefetchUse(frameNo, address);
+			if (write) {
+				markDirtyBitmap(frameNo, address);
+			}
+			return generateAddress(frameNo, address);
+		}
+	}
+	countSmallFault();
+	demandMisses++;
+	interruptBegin();
+	if (options.adaptiveFetch) {
+		adaptFetchGranularity(frameNo, address);
+	}
+	//fetch every missing line in the frame's current fetch block
+	const uint64_t blockBytes = 1 << fetchShift[frameNo];
+	const uint64_t blockStart = address & ~(blockBytes - 1);
+	uint64_t runStart = blockStart;
+	uint64_t runLines = 0;
+	for (uint64_t i = 0; i < (blockBytes >> bitmapShift); i++) {
+		const uint64_t lineAddress = blockStart + (i << bitmapShift);
+		if (!isBitmapValid(lineAddress, get<1>(tlbEntry)) &&
+			!backgroundFetchPending(frameNo, lineAddress)) {
+			if (runLines == 0) {
+				runStart = lineAddress;
+			}
+			runLines++;
+			continue;
+		}
+		if (runLines > 0) {
+			fetchLines(frameNo, tlbEntry, runStart, runLines);
+			runLines = 0;
+		}
+	}
+	if (runLines > 0) {
+		fetchLines(frameNo, tlbEntry, runStart, runLines);
+	}
+	if (write) {
+		markDirtyBitmap(frameNo, address);
+	}
+	if (options.stridePrefetch) {
+		stridePrefetch(address);
+	}
+	interruptEnd();
+	return generateAddress(frameNo, address);
+}
+
+//a load miss takes an MSHR and carries on - the value is not used
+//by trace replay, only later stores and fetches to the line wait
+uint64_t Processor::triggerLoadMiss(
+	const tuple<uint64_t, uint64_t, bool>& tlbEntry,
+	const uint64_t& address)
+{
+	//buffered stores go before any fault handling - they may move
+	//this page, so look the address up again afterwards
+	if (!storeBuffer.empty() && !draining) {
+		drainStoreBuffer();
+		return fetchAddressRead(address, true, false, true);
+	}
+	const uint64_t frameNo =
+		(get<1>(tlbEntry) - PAGESLOCAL) >> pageShift;
+	if (backgroundFetchPending(frameNo, address)) {
+		//the stream buffer only fills a line when it is taken
+		if (!streamBufferHit(address)) {
+			mshrMerges++;
+		}
+		return generateAddress(frameNo, address);
+	}
+	if (mshrsInUse >= options.mshrCount) {
+		mshrFullStalls++;
+		while (mshrsInUse >= options.mshrCount) {
+			waitATick();
+		}
+	}
+	//may have landed while we waited for a free register
+	if (isBitmapValid(address, get<1>(tlbEntry))) {
+		return generateAddress(frameNo, address);
+	}
+	countSmallFault();
+	demandMisses++;
+	if (options.adaptiveFetch) {
+		adaptFetchGranularity(frameNo, address);
+	}
+	const uint64_t blockBytes = 1 << fetchShift[frameNo];
+	const uint64_t blockStart = address & ~(blockBytes - 1);
+	vector<pair<uint64_t, uint64_t>> runs;
+	uint64_t runStart = blockStart;
+	uint64_t runLines = 0;
+	for (uint64_t i = 0; i <= (blockBytes >> bitmapShift); i++) {
+		const uint64_t lineAddress = blockStart + (i << bitmapShift);
+		if (i < (blockBytes >> bitmapShift) &&
+			!isBitmapValid(lineAddress, get<1>(tlbEntry)) &&
+			!backgroundFetchPending(frameNo, lineAddress)) {
+			if (runLines == 0) {
+				runStart = lineAddress;
+			}
+			runLines++;
+			continue;
+		}
+		if (runLines > 0) {
+			//the run holding the missed line goes first
+			if ((address & bitmapMask) >= runStart &&
+				(address & bitmapMask) <
+				runStart + (runLines << bitmapShift)) {
+				runs.insert(runs.begin(),
+					pair<uint64_t, uint64_t>(runStart,
+					runLines));
+			} else {
+				runs.push_back(pair<uint64_t, uint64_t>(
+					runStart, runLines));
+			}
+			runLines = 0;
+		}
+	}
+	//rest of the block only while registers are free
+	for (uint64_t i = 0; i < runs.size(); i++) {
+		if (mshrsInUse >= options.mshrCount) {
+			break;
+		}
+		if (issueBackgroundFetch(frameNo, tlbEntry, runs[i].first,
+			runs[i].second, true)) {
+			linesFetched += runs[i].second;
+			continue;
+		}
+		//the tree would not take it - the missed line cannot be
+		//left behind, so wait for it as a small fault would,
+		//handler and all
+		if (i == 0) {
+			interruptBegin();
+			fetchLines(frameNo, tlbEntry, runs[i].first,
+				runs[i].second);
+			interruptEnd();
+		}
+		break;
+	}
+	if (options.stridePrefetch) {
+		stridePrefetch(address);
+	}
+	return generateAddress(frameNo, address);
+}
+
+//bring in a run of missing lines as one transfer
+void Processor::fetchLines(const uint64_t& frameNo,
+	const tuple<uint64_t, uint64_t, bool>& tlbEntry,
+	const uint64_t& address, const uint64_t& lines)
+{
+	transferGlobalToLocal(address, tlbEntry, lines << bitmapShift);
+	for (uint64_t i = 0; i < lines; i++) {
+		markBitmap(frameNo, address + (i << bitmapShift));
+		clearDirtyBitmap(frameNo, address + (i << bitmapShift));
+	}
+	linesFetched += lines;
+	if (options.cooperativeCaching) {
+		shareLines(frameNo, address, lines);
+	}
+}
+
+//send lines up the tree on a carrier - the carrier is a member of the
+//barrier for as long as the packet is in flight
+bool Processor::issueBackgroundFetch(const uint64_t& frameNo,
+	const tuple<uint64_t, uint64_t, bool>& tlbEntry,
+	const uint64_t& address, const uint64_t& lines, const bool& demand)
+{
+	const uint64_t maskedAddress = address & bitmapMask;
+	BackgroundFetch *fetch = new BackgroundFetch(this, frameNo,
+		get<0>(tlbEntry) & pageMask, maskedAddress,
+		get<1>(tlbEntry) + (maskedAddress & bitMask), lines,
+		lines << bitmapShift, false, demand);
+	return launchBackground(fetch);
+}
+
+bool Processor::launchBackground(BackgroundFetch *fetch)
+{
+	if (!masterTile->treeLeaf->acceptPacketUp(fetch->packet)) {
+		delete fetch;
+		return false;
+	}
+	synchronise();
+	fetch->packet.setSequence(packetsIssued++);
+	if (fetch->demand) {
+		mshrsInUse++;
+	}
+	Tile *tile = masterTile;
+	const bool stamp = masterTile->isDeterministic();
+	fetch->carrier = masterTile->getBarrier()->launch(
+		masterTile->getOrder(), [fetch, tile, stamp]() {
+		tile->treeLeaf->routePacket(fetch->packet);
+		if (stamp) {
+			fetch->arrivalTick = tile->getBarrier()->currentTick();
+		}
+		fetch->arrived = true;
+	}, CARRIER_STACK_BYTES);
+	//stream buffer lines are held by the stream buffer itself
+	if (!fetch->stream) {
+		backgroundFetches.push_back(fetch);
+	}
+	return true;
+}
+
+//copy landed lines into the frame - unless the frame has been handed
+//to another page, or the line was fetched on demand in the meantime
+void Processor::retireBackgroundFetches()
+{
+	auto it = backgroundFetches.begin();
+	while (it != backgroundFetches.end()) {
+		BackgroundFetch *fetch = *it;
+		if (!landed(fetch)) {
+			it++;
+			continue;
+		}
+		if (fetch->carrier) {
+			fetch->carrier->join();
+			delete fetch->carrier;
+		}
+		if (fetch->demand) {
+			mshrsInUse--;
+		}
+		//writes and flushed stream lines just finish
+		if (!fetch->write && !fetch->stream) {
+			landFetch(fetch);
+		}
+		delete fetch;
+		it = backgroundFetches.erase(it);
+	}
+}
+
+//a carrier finishing on this tick may have run before or after us - under
+//deterministic arbitration, whichever it was, its lines wait for the next
+bool Processor::landed(const BackgroundFetch *fetch) const
+{
+	if (!masterTile->isDeterministic()) {
+		return fetch->arrived;
+	}
+	return fetch->arrived &&
+		fetch->arrivalTick < masterTile->getBarrier()->currentTick();
+}
+
+void Processor::landFetch(BackgroundFetch *fetch)
+{
+	const uint64_t pteAddress = (1 << pageShift) * KERNELPAGES +
+		fetch->frameNo * PAGETABLEENTRY;
+	const uint64_t frameBase =
+		PAGESLOCAL + fetch->frameNo * (1 << pageShift);
+	if (!(localMemory->readWord32(pteAddress + FLAGOFFSET) & 0x01) ||
+		localMemory->readLong(pteAddress + VOFFSET) !=
+		fetch->pageAddress) {
+		return;
+	}
+	const vector<uint8_t> answer = fetch->packet.getMemory();
+	for (uint64_t i = 0; i < fetch->lines; i++) {
+		const uint64_t lineAddress =
+			fetch->address + (i << bitmapShift);
+		if (isBitmapValid(lineAddress, frameBase)) {
+			continue;
+		}
+		for (uint64_t j = 0; j < bitmapBytes; j++) {
+			masterTile->writeByte(frameBase +
+				(lineAddress & bitMask) + j,
+				answer[(i << bitmapShift) + j]);
+		}
+		markBitmap(fetch->frameNo, lineAddress);
+		clearDirtyBitmap(fetch->frameNo, lineAddress);
+		if (fetch->demand || fetch->stream) {
+			continue;
+		}
+		prefetchedLines[fetch->frameNo]
+			[(lineAddress & bitMask) >> bitmapShift] = true;
+	}
+}
+
+//take the line from the stream buffer if it is there - runs ahead
+//of it were skipped over and go
+bool Processor::streamBufferHit(const uint64_t& address)
+{
+	const uint64_t lineAddress = address & bitmapMask;
+	bool found = false;
+	for (auto fetch: streamBuffer) {
+		if (lineAddress >= fetch->address && lineAddress <
+			fetch->address + (fetch->lines << bitmapShift)) {
+			found = true;
+			break;
+		}
+	}
+	if (!found) {
+		return false;
+	}
+	//the carriers keep the barrier's time, not ours
+	synchronise();
+	while (lineAddress >= streamBuffer.front()->address +
+		(streamBuffer.front()->lines << bitmapShift)) {
+		backgroundFetches.push_back(streamBuffer.front());
+		streamBuffer.pop_front();
+	}
+	BackgroundFetch *fetch = streamBuffer.front();
+	streamBuffer.pop_front();
+	//the fetch is held by neither list now, so nothing stops the
+	//ticks spent waiting for it being run ahead - hold the barrier,
+	//catching up with any the clock or cleaner ran ahead meanwhile
+	if (!landed(fetch)) {
+		streamLate++;
+		do {
+			holdTicks(1);
+			synchronise();
+		} while (!landed(fetch));
+	}
+	if (fetch->carrier) {
+		fetch->carrier->join();
+		delete fetch->carrier;
+	}
+	landFetch(fetch);
+	delete fetch;
+	streamHits++;
+	streamBufferTopUp();
+	return true;
+}
+
+//restart the stream behind a code miss
+void Processor::streamBufferAllocate(const uint64_t& address)
+{
+	flushStreamBuffer();
+	streamNextLine = (address & bitmapMask) + bitmapBytes;
+	streamBufferTopUp();
+}
+
+//keep K lines in flight ahead of the stream as one run - stopping at
+//the end of the page, code beyond it may not be resident
+void Processor::streamBufferTopUp()
+{
+	uint64_t linesHeld = 0;
+	for (auto fetch: streamBuffer) {
+		linesHeld += fetch->lines;
+	}
+	if (linesHeld >= options.streamBufferLines ||
+		(streamNextLine & bitMask) == 0) {
+		return;
+	}
+	uint64_t y = 0;
+	bool mapped = false;
+	for (auto x: tlbs) {
+		if (get<2>(x) && ((streamNextLine & pageMask) ==
+			(get<0>(x) & pageMask))) {
+			mapped = true;
+			break;
+		}
+		y++;
+	}
+	if (!mapped) {
+		return;
+	}
+	//lines already here need no fetching
+	while ((streamNextLine & bitMask) != 0 &&
+		(isBitmapValid(streamNextLine, get<1>(tlbs[y])) ||
+		backgroundFetchPending(y, streamNextLine))) {
+		streamNextLine += bitmapBytes;
+	}
+	const uint64_t runStart = streamNextLine;
+	uint64_t runLines = 0;
+	while (linesHeld + runLines < options.streamBufferLines &&
+		(streamNextLine & bitMask) != 0 &&
+		!isBitmapValid(streamNextLine, get<1>(tlbs[y])) &&
+		!backgroundFetchPending(y, streamNextLine)) {
+		runLines++;
+		streamNextLine += bitmapBytes;
+	}
+	if (runLines == 0) {
+		return;
+	}
+	BackgroundFetch *fetch = new BackgroundFetch(this, y,
+		get<0>(tlbs[y]) & pageMask, runStart,
+		get<1>(tlbs[y]) + (runStart & bitMask), runLines,
+		runLines << bitmapShift, false, false, true);
+	if (launchBackground(fetch)) {
+		streamBuffer.push_back(fetch);
+	}
+}
+
+//lines still in flight finish with the other background transfers
+void Processor::flushStreamBuffer()
+{
+	if (streamBuffer.empty()) {
+		return;
+	}
+	streamFlushes++;
+	for (auto fetch: streamBuffer) {
+		backgroundFetches.push_back(fetch);
+	}
+	streamBuffer.clear();
+}
+
+//lines on their way to the frame - held stream buffer lines count, but
+//not flushed ones, which will never be filled in
+bool Processor::backgroundFetchPending(const uint64_t& frameNo,
+	const uint64_t& address) const
+{
+	const uint64_t lineAddress = address & bitmapMask;
+	auto covers = [&](const BackgroundFetch *fetch) {
+		return fetch->frameNo == frameNo &&
+			(fetch->address & pageMask) == (address & pageMask) &&
+			lineAddress >= fetch->address &&
+			lineAddress < fetch->address +
+			(fetch->lines << bitmapShift);
+	};
+	for (auto fetch: backgroundFetches) {
+		if (!fetch->write && !fetch->stream && covers(fetch)) {
+			return true;
+		}
+	}
+	for (auto fetch: streamBuffer) {
+		if (covers(fetch)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Processor::frameDirty(const uint64_t& frameNo) const
+{
+	const uint64_t dirtyBase =
+		dirtyBitmapOffset() + frameNo * bitmapSizeBytes;
+	for (uint64_t i = 0; i < bitmapSizeBytes; i++) {
+		if (localMemory->readByte(dirtyBase + i)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+//read runs of dirty lines out as a DMA engine would and let the write
+//packets carry them to global memory on their own
+void Processor::cleanFrame(const uint64_t& frameNo, uint64_t& budget)
+{
+	const uint64_t pteAddress =
+		(1 << pageShift) * KERNELPAGES + frameNo * PAGETABLEENTRY;
+	//global page tables map straight through
+	const uint64_t globalPage =
+		localMemory->readLong(pteAddress) & ~ASID_MASK;
+	const uint64_t frameBase = PAGESLOCAL + frameNo * (1 << pageShift);
+	const uint64_t bitmapSize = (1 << pageShift) >> bitmapShift;
+	const uint64_t firstBit = frameNo * bitmapSizeBytes * BITS_PER_BYTE;
+	const uint64_t dirtyOffset = dirtyBitmapOffset();
+	uint64_t i = 0;
+	while (i < bitmapSize && budget > 0) {
+		uint64_t bitToRead = firstBit + i;
+		if (!(localMemory->readByte(dirtyOffset + bitToRead / 8) &
+			(1 << (bitToRead % 8)))) {
+			i++;
+			continue;
+		}
+		uint64_t runLength = 1;
+		while (i + runLength < bitmapSize &&
+			runLength < options.burstLines && runLength < budget) {
+			bitToRead = firstBit + i + runLength;
+			if (!(localMemory->readByte(dirtyOffset +
+				bitToRead / 8) & (1 << (bitToRead % 8)))) {
+				break;
+			}
+			runLength++;
+		}
+		if (backgroundFetches.size() >= MAX_BACKGROUND_FETCHES) {
+			budget = 0;
+			return;
+		}
+		BackgroundFetch *fetch = new BackgroundFetch(this, frameNo,
+			localMemory->readLong(pteAddress),
+			globalPage + i * bitmapBytes,
+			frameBase + i * bitmapBytes, runLength,
+			runLength * bitmapBytes, true);
+		for (uint64_t j = 0; j < runLength * bitmapBytes; j++) {
+			fetch->packet.fillBuffer(masterTile->readByte(
+				frameBase + i * bitmapBytes + j));
+		}
+		//lines stay dirty unless the burst is on its way
+		if (!launchBackground(fetch)) {
+			budget = 0;
+			return;
+		}
+		for (uint64_t j = 0; j < runLength; j++) {
+			clearDirtyBitmap(frameNo,
+				globalPage + ((i + j) << bitmapShift));
+		}
+		linesCleaned += runLength;
+		budget -= runLength;
+		i += runLength;
+	}
+}
+
+//a cleaner burst for the frame still in the tree
+bool Processor::cleanerWritePending(const uint64_t& frameNo) const
+{
+	for (auto fetch: backgroundFetches) {
+		if (fetch->write && fetch->frameNo == frameNo &&
+			!landed(fetch)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+//a burst landing after the frame is written back or handed to another
+//page would put stale lines over newer ones - let it land first
+void Processor::settleCleanerWrites(const uint64_t& frameNo)
+{
+	//the carriers keep the barrier's time, not ours
+	synchronise();
+	while (cleanerWritePending(frameNo)) {
+		waitATick();
+	}
+}
+
+//keep a few cold frames clean so hard faults need not write back
+void Processor::runCleaner()
+{
+	uint64_t cleanCold = 0;
+	uint64_t budget = cleanerLines;
+	uint64_t scanned = 0;
+	for (; scanned < pagesAvailable && budget > 0; scanned++) {
+		const uint64_t frameNo =
+			(cleanerHand + scanned) % pagesAvailable;
+		const uint32_t flags = localMemory->readWord32(
+			(1 << pageShift) * KERNELPAGES +
+			frameNo * PAGETABLEENTRY + FLAGOFFSET);
+		if (!(flags & 0x01) || (flags & 0x04)) {
+			continue;
+		}
+		if ((flags & 0x02) || (flags & 0x08)) {
+			continue;
+		}
+		//bursts for the same lines must land in the order they left
+		if (cleanerWritePending(frameNo)) {
+			continue;
+		}
+		if (frameDirty(frameNo)) {
+			cleanFrame(frameNo, budget);
+			if (frameDirty(frameNo)) {
+				cleanerHand = frameNo;
+				return;
+			}
+		}
+		if (++cleanCold >= cleanerPool) {
+			scanned++;
+			break;
+		}
+	}
+	//next run starts past every frame looked at in this one
+	cleanerHand = (cleanerHand + scanned) % pagesAvailable;
+}
+
+//watch the stride between small faults and run ahead of it once it
+//repeats - never into pages that are not already resident
+void Processor::stridePrefetch(const uint64_t& address)
+{
+	const uint64_t line = address >> bitmapShift;
+	const int64_t stride = line - lastPrefetchLine;
+	if (stride != 0 && stride == prefetchStride) {
+		if (prefetchConfidence < PREFETCH_CONFIDENCE) {
+			prefetchConfidence++;
+		}
+	} else {
+		prefetchConfidence = 0;
+	}
+	prefetchStride = stride;
+	lastPrefetchLine = line;
+	if (prefetchConfidence < PREFETCH_CONFIDENCE) {
+		return;
+	}
+	for (uint64_t i = 1; i <= PREFETCH_DEGREE; i++) {
+		const uint64_t target = (line + i * stride) << bitmapShift;
+		uint64_t y = 0;
+		for (auto x: tlbs) {
+			if (get<2>(x) && ((target & pageMask) ==
+				(get<0>(x) & pageMask))) {
+				prefetchBlock(y, x, target);
+				break;
+			}
+			y++;
+		}
+	}
+}
+
+//fetch the missing lines of the target's fetch block, skipping any
+//already present or in flight
+void Processor::prefetchBlock(const uint64_t& frameNo,
+	const tuple<uint64_t, uint64_t, bool>& tlbEntry,
+	const uint64_t& address)
+{
+	const uint64_t blockBytes = 1 << fetchShift[frameNo];
+	const uint64_t blockStart = address & ~(blockBytes - 1);
+	uint64_t runStart = blockStart;
+	uint64_t runLines = 0;
+	for (uint64_t i = 0; i <= (blockBytes >> bitmapShift); i++) {
+		const uint64_t lineAddress = blockStart + (i << bitmapShift);
+		if (i < (blockBytes >> bitmapShift) &&
+			!isBitmapValid(lineAddress, get<1>(tlbEntry)) &&
+			!backgroundFetchPending(frameNo, lineAddress)) {
+			if (runLines == 0) {
+				runStart = lineAddress;
+			}
+			runLines++;
+			continue;
+		}
+		if (runLines > 0) {
+			if (backgroundFetches.size() >=
+				MAX_BACKGROUND_FETCHES) {
+				return;
+			}
+			issueBackgroundFetch(frameNo, tlbEntry, runStart,
+				runLines);
+			prefetchLines += runLines;
+			runLines = 0;
+		}
+	}
+}
+
+//a demand hit on a prefetched line moves the stream on as the miss it
+//replaced would have - stores retired in the background only count it
+void Processor::notePrefetchUse(const uint64_t& frameNo,
+	const uint64_t& address, const bool& train)
+{
+	if (!options.stridePrefetch) {
+		return;
+	}
+	const uint64_t line = (address & bitMask) >> bitmapShift;
+	if (!prefetchedLines[frameNo][line]) {
+		return;
+	}
+	prefetchedLines[frameNo][line] = false;
+	prefetchHits++;
+	if (train) {
+		stridePrefetch(address);
+	}
 }
 
-uint64_t Processor::triggerSmallFault(
-	const tuple<uint64_t, uint64_t, bool>& tlbEntry,
-	const uint64_t& address, const bool& write)
+//widen the frame's fetch block while small faults stream through
+//adjacent blocks, narrow it again when they scatter
+void Processor::adaptFetchGranularity(const uint64_t& frameNo,
+	const uint64_t& address)
 {
-	emit smallFault();
-	smallFaultCount++;
-	interruptBegin();
-	transferGlobalToLocal(address, tlbEntry, BITMAP_BYTES);
-	const uint64_t frameNo =
-		(get<1>(tlbEntry) - PAGESLOCAL) >> pageShift;
-	markBitmap(frameNo, address);
-	interruptEnd();
-	return generateAddress(frameNo, address);
+	const uint64_t blockShift = fetchShift[frameNo];
+	const uint64_t block = (address & bitMask) >> blockShift;
+	const uint64_t lastBlock = lastFaultOffset[frameNo] >> blockShift;
+	if (lastFaultOffset[frameNo] <= bitMask &&
+		(block == lastBlock + 1 || lastBlock == block + 1)) {
+		if (++adjacentFaults[frameNo] >= FETCH_WIDEN_AFTER &&
+			blockShift < (uint64_t)pageShift) {
+			fetchShift[frameNo] = blockShift + FETCH_STEP_SHIFT;
+			if (fetchShift[frameNo] > (uint64_t)pageShift) {
+				fetchShift[frameNo] = pageShift;
+			}
+			adjacentFaults[frameNo] = 0;
+			fetchWidenings++;
+		}
+	} else {
+		if (blockShift > bitmapShift) {
+			fetchShift[frameNo] = blockShift - FETCH_STEP_SHIFT;
+			if (fetchShift[frameNo] < bitmapShift) {
+				fetchShift[frameNo] = bitmapShift;
+			}
+			fetchNarrowings++;
+		}
+		adjacentFaults[frameNo] = 0;
+	}
+	lastFaultOffset[frameNo] = address & bitMask;
 }
 
 const pair<const uint64_t, bool> Processor::getRandomFrame()
@@ -352,9 +1338,20 @@ const pair<const uint64_t, bool> Processor::getRandomFrame()
 	waitATick();
 	//See 3.2.1 of Knuth (third edition)
 	//simple ramdom number generator
-	randomPage = (1 * randomPage + 1)%FREEPAGES;
-	waitATick(); //store
-	return pair<const uint64_t, bool>(randomPage + BASEPAGES, true);
+	//pinned frames are fixed - step over them, but only once round
+	for (uint64_t i = 0; i < freePages; i++) {
+		randomPage = (1 * randomPage + 1)%freePages;
+		if (!(localMemory->readWord32((1 << pageShift) * KERNELPAGES +
+			(randomPage + basePages) * PAGETABLEENTRY + FLAGOFFSET) &
+			0x02)) {
+			waitATick(); //store
+			return pair<const uint64_t, bool>(
+				randomPage + basePages, true);
+		}
+	}
+	cerr << "Processor " << processorNumber;
+	cerr << " has every frame fixed - none left to page into." << endl;
+	exit(EXIT_FAILURE);
 }
 
 //nominate a frame to be used
@@ -364,6 +1361,7 @@ const pair<const uint64_t, bool> Processor::getFreeFrame()
 	//we assume this to be subcycle
 	uint64_t frames = (localMemory->getSize()) >> pageShift;
 	uint64_t couldBe = 0xFFFF;
+	uint64_t cleanCouldBe = 0xFFFF;
 	for (uint64_t i = 0; i < frames; i++) {
 		uint32_t flags = masterTile->readWord32(
 			(1 << pageShift) * KERNELPAGES
@@ -376,8 +1374,15 @@ const pair<const uint64_t, bool> Processor::getFreeFrame()
 		}
         	else if (!(flags & 0x04)) {
 			couldBe = i;
+			if (!frameDirty(i)) {
+				cleanCouldBe = i;
+			}
 		}
 	}
+	//a cold frame the cleaner has been through costs no write back
+	if (cleanCouldBe < 0xFFFF) {
+		return pair<const uint64_t, bool>(cleanCouldBe, true);
+	}
 	if (couldBe < 0xFFFF) {
 		return pair<const uint64_t, bool>(couldBe, true);
 	}
@@ -394,6 +1399,19 @@ void Processor::dropPage(const uint64_t& frameNo)
 		frameNo * PAGETABLEENTRY + PAGESLOCAL + VOFFSET +
 		(1 << pageShift)* KERNELPAGES);
 	dumpPageFromTLB(pageAddress);
+	if (options.hashedPageTable) {
+		hashRemove(pageAddress, frameNo);
+	}
+	if (options.cooperativeCaching) {
+		unshareFrame(frameNo);
+	}
+	//a pinned page gives its frame back to the budget
+	const uint32_t oldFlags = masterTile->readWord32(frameNo *
+		PAGETABLEENTRY + PAGESLOCAL + FLAGOFFSET +
+		(1 << pageShift) * KERNELPAGES);
+	if ((oldFlags & 0x02) && pageAddress < PAGESLOCAL) {
+		pinnedFrames--;
+	}
 	//mark as invalid in page table
 	waitATick();
 	masterTile->writeWord32(frameNo * PAGETABLEENTRY + PAGESLOCAL +
@@ -408,48 +1426,61 @@ void Processor::writeBackMemory(const uint64_t& frameNo)
 		frameNo * PAGETABLEENTRY + FLAGOFFSET) & 0x08) {
     		return;
 	}
-	//find bitmap for this frame
+	//find bitmaps for this frame - only dirty lines go back
 	const uint64_t totalPTEPages =
 		masterTile->readLong(fetchAddressRead(PAGESLOCAL));
 	const uint64_t bitmapOffset =
 		(KERNELPAGES + totalPTEPages) * (1 << pageShift);
-	const uint64_t bitmapSize = (1 << pageShift) / BITMAP_BYTES;
-	uint64_t bitToRead = frameNo * bitmapSize;
+	const uint64_t dirtyOffset = dirtyBitmapOffset();
+	const uint64_t bitmapSize = (1 << pageShift) >> bitmapShift;
+	const uint64_t firstBit = frameNo * bitmapSizeBytes * BITS_PER_BYTE;
 	const uint64_t physicalAddress = mapToGlobalAddress(
 		localMemory->readLong((1 << pageShift) * KERNELPAGES +
 		frameNo * PAGETABLEENTRY)).first;
-	long byteToRead = -1;
-	uint8_t byteBit = 0;
-	for (unsigned int i = 0; i < bitmapSize; i++)
-	{
-		long nextByte = bitToRead / 8;
-		if (nextByte != byteToRead) {
-			byteBit =
-				localMemory->readByte(bitmapOffset + nextByte);
-			byteToRead = nextByte;
-		}
-		uint8_t actualBit = bitToRead%8;
-		if (byteBit & (1 << actualBit)) {
-			//simulate transfer
-			transferLocalToGlobal(frameNo * (1 << pageShift) +
-				PAGESLOCAL +
-				i * BITMAP_BYTES, tlbs[frameNo], BITMAP_BYTES);
-			for (unsigned int j = 0;
-				j < BITMAP_BYTES/sizeof(uint64_t); j++)
-			{
-				//actual transfer done in here
-				waitATick();
-				uint64_t toGo = masterTile->readLong(
-					fetchAddressRead(
-					frameNo * (1 << pageShift) +
-					PAGESLOCAL + i * BITMAP_BYTES +
-					j * sizeof(uint64_t)));
-				masterTile->writeLong(fetchAddressWrite(
-					physicalAddress + i * BITMAP_BYTES
-					+ j * sizeof(uint64_t)), toGo);
+	uint64_t i = 0;
+	while (i < bitmapSize) {
+		uint64_t bitToRead = firstBit + i;
+		if (!(localMemory->readByte(dirtyOffset + bitToRead / 8) &
+			(1 << (bitToRead % 8)))) {
+			if (localMemory->readByte(bitmapOffset +
+				bitToRead / 8) & (1 << (bitToRead % 8))) {
+				cleanLinesSkipped++;
+			}
+			i++;
+			continue;
+		}
+		//extend to the longest run of dirty lines we can burst
+		uint64_t runLength = 1;
+		while (i + runLength < bitmapSize &&
+			runLength < options.burstLines) {
+			bitToRead = firstBit + i + runLength;
+			if (!(localMemory->readByte(dirtyOffset +
+				bitToRead / 8) & (1 << (bitToRead % 8)))) {
+				break;
 			}
+			runLength++;
+		}
+		dirtyLinesWritten += runLength;
+		burstsWritten++;
+		//simulate transfer - one packet for the whole run
+		transferLocalToGlobal(frameNo * (1 << pageShift) +
+			PAGESLOCAL + i * bitmapBytes, tlbs[frameNo],
+			runLength * bitmapBytes);
+		for (unsigned int j = 0;
+			j < (runLength * bitmapBytes)/sizeof(uint64_t); j++)
+		{
+			//actual transfer done in here
+			waitATick();
+			uint64_t toGo = masterTile->readLong(
+				fetchAddressRead(
+				frameNo * (1 << pageShift) +
+				PAGESLOCAL + i * bitmapBytes +
+				j * sizeof(uint64_t)));
+			masterTile->writeLong(fetchAddressWrite(
+				physicalAddress + i * bitmapBytes
+				+ j * sizeof(uint64_t)), toGo);
 		}
-		bitToRead++;
+		i += runLength;
 	}
 }
 
@@ -459,6 +1490,17 @@ void Processor::fixPageMap(const uint64_t& frameNo,
 	const uint64_t pageAddress = address & pageMask;
 	const uint64_t writeBase =
 		KERNELPAGES * (1 << pageShift) + frameNo * PAGETABLEENTRY;
+	if (options.cooperativeCaching) {
+		unshareFrame(frameNo);
+	}
+	if (options.hashedPageTable) {
+		//the frame's old page leaves the hash
+		if (localMemory->readWord32(writeBase + FLAGOFFSET) & 0x01) {
+			hashRemove(localMemory->readLong(writeBase + VOFFSET),
+				frameNo);
+		}
+		hashInsert(pageAddress, frameNo);
+	}
 	waitATick();
 	localMemory->writeLong(writeBase + VOFFSET, pageAddress);
 	waitATick();
@@ -474,6 +1516,15 @@ void Processor::fixPageMapStart(const uint64_t& frameNo,
 	const uint64_t& address) 
 {
 	const uint64_t pageAddress = address & pageMask;
+	if (options.hashedPageTable) {
+		const uint64_t entry =
+			(1 << pageShift) * KERNELPAGES + frameNo * PAGETABLEENTRY;
+		if (localMemory->readWord32(entry + FLAGOFFSET) & 0x01) {
+			hashRemove(localMemory->readLong(entry + VOFFSET),
+				frameNo, false);
+		}
+		hashInsert(pageAddress, frameNo, false);
+	}
 	localMemory->writeLong((1 << pageShift) * KERNELPAGES +
 		frameNo * PAGETABLEENTRY + VOFFSET, pageAddress);
 	localMemory->writeWord32((1 << pageShift) * KERNELPAGES  +
@@ -482,13 +1533,13 @@ void Processor::fixPageMapStart(const uint64_t& frameNo,
 
 void Processor::fixBitmap(const uint64_t& frameNo)
 {
+	prefetchedLines[frameNo].assign(prefetchedLines[frameNo].size(),
+		false);
 	const uint64_t totalPTEPages =
 		masterTile->readLong(fetchAddressRead(PAGESLOCAL));
 	uint64_t bitmapOffset =
 		(KERNELPAGES + totalPTEPages) * (1 << pageShift);
-	const uint64_t bitmapSizeBytes =
-		(1 << pageShift) / (BITMAP_BYTES * 8);
-	const uint64_t bitmapSizeBits = bitmapSizeBytes * 8;
+	const uint64_t bitmapSizeBits = bitmapSizeBytes * BITS_PER_BYTE;
 	uint8_t bitmapByte = localMemory->readByte(
 		frameNo * bitmapSizeBytes + bitmapOffset);
 	uint8_t startBit = (frameNo * bitmapSizeBits) % 8;
@@ -513,13 +1564,14 @@ void Processor::markBitmapStart(const uint64_t &frameNo,
 		masterTile->readLong(PAGESLOCAL);
 	uint64_t bitmapOffset =
 		(KERNELPAGES + totalPTEPages) * (1 << pageShift);
-	const uint64_t bitmapSizeBytes =
-		(1 << pageShift) / (BITMAP_BYTES * 8);
+	const uint64_t dirtyOffset = dirtyBitmapOffset();
 	for (unsigned int i = 0; i < bitmapSizeBytes; i++) {
 		localMemory->writeByte(
 			frameNo * bitmapSizeBytes + i + bitmapOffset, '\0');
+		localMemory->writeByte(
+			frameNo * bitmapSizeBytes + i + dirtyOffset, '\0');
 	}
-	uint64_t bitToMark = (address & bitMask) / BITMAP_BYTES;
+	uint64_t bitToMark = (address & bitMask) >> bitmapShift;
 	const uint64_t byteToFetch = (bitToMark / 8) +
 		frameNo * bitmapSizeBytes + bitmapOffset;
 	bitToMark %= 8;
@@ -535,18 +1587,39 @@ void Processor::markBitmap(const uint64_t& frameNo,
 		masterTile->readLong(PAGESLOCAL);
 	uint64_t bitmapOffset =
 		(KERNELPAGES + totalPTEPages) * (1 << pageShift);
-	const uint64_t bitmapSizeBytes =
-		(1 << pageShift) / (BITMAP_BYTES * 8);
-	uint64_t bitToMark = (address & bitMask) / BITMAP_BYTES;
+	uint64_t bitToMark = (address & bitMask) >> bitmapShift;
 	const uint64_t byteToFetch = (bitToMark / 8) +
 		frameNo * bitmapSizeBytes + bitmapOffset;
 	bitToMark %= 8;
 	uint8_t bitmapByte = localMemory->readByte(byteToFetch);
 	bitmapByte |= (1 << bitToMark);
 	localMemory->writeByte(byteToFetch, bitmapByte);
-	for (uint64_t i = 0; i < BITMAPDELAY; i++) {
-		waitATick();
-    	}
+	waitTicks(BITMAPDELAY);
+}
+
+void Processor::markDirtyBitmap(const uint64_t& frameNo,
+	const uint64_t& address)
+{
+	uint64_t bitToMark = (address & bitMask) >> bitmapShift;
+	const uint64_t byteToFetch = (bitToMark / 8) +
+		frameNo * bitmapSizeBytes + dirtyBitmapOffset();
+	bitToMark %= 8;
+	uint8_t bitmapByte = localMemory->readByte(byteToFetch);
+	bitmapByte |= (1 << bitToMark);
+	localMemory->writeByte(byteToFetch, bitmapByte);
+}
+
+//line has just been fetched from global memory so is clean
+void Processor::clearDirtyBitmap(const uint64_t& frameNo,
+	const uint64_t& address)
+{
+	uint64_t bitToClear = (address & bitMask) >> bitmapShift;
+	const uint64_t byteToFetch = (bitToClear / 8) +
+		frameNo * bitmapSizeBytes + dirtyBitmapOffset();
+	bitToClear %= 8;
+	uint8_t bitmapByte = localMemory->readByte(byteToFetch);
+	bitmapByte &= ~(1 << bitToClear);
+	localMemory->writeByte(byteToFetch, bitmapByte);
 }
 
 void Processor::markBitmapInit(const uint64_t& frameNo,
@@ -556,9 +1629,7 @@ void Processor::markBitmapInit(const uint64_t& frameNo,
 		masterTile->readLong(PAGESLOCAL);
 	uint64_t bitmapOffset =
 		(KERNELPAGES + totalPTEPages) * (1 << pageShift);
-	const uint64_t bitmapSizeBytes =
-		(1 << pageShift) / (BITMAP_BYTES * 8);
-	uint64_t bitToMark = (address & bitMask) / BITMAP_BYTES;
+	uint64_t bitToMark = (address & bitMask) >> bitmapShift;
 	const uint64_t byteToFetch = (bitToMark / 8) +
 		frameNo * bitmapSizeBytes + bitmapOffset;
 	bitToMark %= 8;
@@ -649,24 +1720,62 @@ const pair<uint64_t, uint8_t>
 uint64_t Processor::triggerHardFault(const uint64_t& address,
     const bool& readOnly, const bool& write)
 {
-	emit hardFault();
-	hardFaultCount++;
+	if (!storeBuffer.empty() && !draining) {
+		drainStoreBuffer();
+		if (write) {
+			return fetchAddressWrite(address);
+		}
+		return fetchAddressRead(address, readOnly);
+	}
+	countHardFault();
 	interruptBegin();
 	const pair<const uint64_t, bool> frameData = getFreeFrame();
 	if (frameData.second) {
-		writeBackMemory(frameData.first);
+		settleCleanerWrites(frameData.first);
+		if (frameDirty(frameData.first)) {
+			writeBackMemory(frameData.first);
+		} else {
+			cleanVictims++;
+		}
 	}
 	fixBitmap(frameData.first);
 	pair<uint64_t, uint8_t> translatedAddress = mapToGlobalAddress(address);
-	fixTLB(frameData.first, translatedAddress.first);
-	transferGlobalToLocal(translatedAddress.first + (address & bitMask),
-		tlbs[frameData.first], BITMAP_BYTES);
-	fixPageMap(frameData.first, translatedAddress.first, readOnly);
-	markBitmapStart(frameData.first, translatedAddress.first +
-		(address & bitMask));
-	for (uint64_t i = 0; i < BITMAPDELAY; i++) {
-		waitATick();
+	//the global tables know nothing of ASIDs - put ours back
+	const uint64_t taggedAddress =
+		translatedAddress.first | (address & ASID_MASK);
+	fixTLB(frameData.first, taggedAddress);
+	//a new page starts from one line, whatever the frame held before
+	fetchShift[frameData.first] = bitmapShift;
+	lastFaultOffset[frameData.first] = address & bitMask;
+	adjacentFaults[frameData.first] = 0;
+	const uint64_t faultAddress =
+		translatedAddress.first + (address & bitMask);
+	const uint64_t blockBytes = 1 << fetchShift[frameData.first];
+	const uint64_t blockStart = faultAddress & ~(blockBytes - 1);
+	const bool shared = options.cooperativeCaching && readOnly && !write;
+	if (!shared || !fetchFromNeighbour(blockStart, tlbs[frameData.first],
+		blockBytes)) {
+		transferGlobalToLocal(blockStart, tlbs[frameData.first],
+			blockBytes);
+	}
+	fixPageMap(frameData.first, taggedAddress, readOnly);
+	if (shared) {
+		shareLines(frameData.first, blockStart,
+			blockBytes >> bitmapShift);
+	}
+	if (!pinnedPages.empty() &&
+		pinnedPages.count(taggedAddress & pageMask)) {
+		applyPin(frameData.first);
+	}
+	markBitmapStart(frameData.first, faultAddress);
+	for (uint64_t i = 0; i < (blockBytes >> bitmapShift); i++) {
+		markBitmap(frameData.first, blockStart + (i << bitmapShift));
+	}
+	linesFetched += blockBytes >> bitmapShift;
+	if (write) {
+		markDirtyBitmap(frameData.first, address);
 	}
+	waitTicks(BITMAPDELAY);
 	interruptEnd();
 	return generateAddress(frameData.first, translatedAddress.first +
 		(address & bitMask));
@@ -679,14 +1788,16 @@ void Processor::incrementBlocks()
         blocks++;
 }
 
-void Processor::incrementServiceTime()
+void Processor::incrementServiceTime(const uint64_t& count)
 {
-        serviceTime++;
+        serviceTime += count;
 }
 
 //when this returns, address guarenteed to be present at returned local address
+//- code fetches go through the stream buffer
 uint64_t Processor::fetchAddressRead(const uint64_t& address,
-	const bool& readOnly, const bool& write)
+	const bool& readOnly, const bool& write, const bool& load,
+	const bool& instruction)
 {
 	//implement paging logic
 	if (mode == VIRTUAL) {
@@ -696,47 +1807,60 @@ uint64_t Processor::fetchAddressRead(const uint64_t& address,
 			if (get<2>(x) && ((pageSought) ==
 						(get<0>(x) & pageMask))) {
 				//entry in TLB - check bitmap
-				for (uint64_t i = 0; i < BITMAPDELAY; i++) {
-					waitATick();
+				waitTicks(BITMAPDELAY);
+				if (!isBitmapValid(address, get<1>(x)) &&
+					instruction &&
+					options.streamBufferLines > 0 &&
+					streamBufferHit(address) &&
+					isBitmapValid(address, get<1>(x))) {
+					return generateAddress(y, address);
 				}
 				if (!isBitmapValid(address, get<1>(x))) {
+					if (instruction &&
+						options.streamBufferLines > 0) {
+						streamMisses++;
+						const uint64_t local =
+							triggerSmallFault(x,
+							address, write,
+							readOnly, load);
+						streamBufferAllocate(address);
+						return local;
+					}
+					if (load && !write &&
+						options.mshrCount > 0) {
+						return triggerLoadMiss(x,
+							address);
+					}
 					return triggerSmallFault(x,
-						address, write);
+						address, write, readOnly,
+						load);
 				}
+				notePrefetchUse(y, address);
 				return generateAddress(y, address);
 			}
             		y++;
 		}
 		//not in TLB - but check if it is in page table
 		waitATick(); 
-		for (unsigned int i = 0; i < TOTAL_LOCAL_PAGES; i++) {
-			waitATick();
-            		uint64_t addressInPageTable = PAGESLOCAL +
-                        	(i * PAGETABLEENTRY) + 
+		uint64_t i = 0;
+		if (walkPageTable(pageSought, i)) {
+			uint64_t addressInPageTable = PAGESLOCAL +
+				(i * PAGETABLEENTRY) +
 				(1 << pageShift) * KERNELPAGES;
-            		uint64_t flags =
+			uint64_t flags =
 				masterTile->readWord32(addressInPageTable
-                        	+ FLAGOFFSET);
-            		if (!(flags & 0x01)) {
-                		continue;
-            		}
-            		waitATick();
-            		uint64_t storedPage = masterTile->readLong(
-                        	addressInPageTable + VOFFSET);
-            		waitATick();
-            		if (pageSought == storedPage) {
-                		waitATick();
-                		flags |= 0x04;
-                		masterTile->writeWord32(
-					addressInPageTable + FLAGOFFSET,
-                    			flags);
-                		waitATick();
-                		fixTLB(i, address);
-                		waitATick();
-                		return fetchAddressRead(address);
-            		}
+				+ FLAGOFFSET);
+			waitATick();
+			flags |= 0x04;
+			masterTile->writeWord32(
+				addressInPageTable + FLAGOFFSET,
+				flags);
+			waitATick();
+			fixTLB(i, address);
 			waitATick();
-        	}
+			return fetchAddressRead(address,
+				readOnly, write, load, instruction);
+		}
         	waitATick();
         	return triggerHardFault(address, readOnly, write);
 	} else {
@@ -759,58 +1883,52 @@ uint64_t Processor::fetchAddressWrite(const uint64_t& address)
 				uint64_t baseAddress = PAGESLOCAL +
 					(y * PAGETABLEENTRY) +
 					(1 << pageShift) * KERNELPAGES;
-				uint64_t addressPT = masterTile->
-					readLong(baseAddress + VOFFSET);
 				uint32_t oldFlags = masterTile->
 					readWord32(baseAddress + FLAGOFFSET);
 				if (oldFlags & 0x08) {
+					if (options.cooperativeCaching) {
+						unshareFrame(y);
+					}
 					waitATick();
 					oldFlags = oldFlags^0x08;	
 					masterTile->writeWord32(baseAddress +
 						FLAGOFFSET, oldFlags|0x05);
 					waitATick();
 				}
-				for (uint64_t i = 0; i < BITMAPDELAY; i++) {
-					waitATick();
-				}
+				waitTicks(BITMAPDELAY);
 				if (!isBitmapValid(address, get<1>(x))) {
 					return triggerSmallFault(x, address,
 						true);
 				}
+				markDirtyBitmap(y, address);
+				notePrefetchUse(y, address);
 				return generateAddress(y, address);
 			}
 			y++;
 		}
 		//not in TLB - but check if it is in page table
 		waitATick();
-		for (unsigned int i = 0; i < TOTAL_LOCAL_PAGES; i++) {
-			waitATick();
+		uint64_t i = 0;
+		if (walkPageTable(pageSought, i)) {
 			uint64_t addressInPageTable = PAGESLOCAL +
 				(i * PAGETABLEENTRY) +
 				(1 << pageShift) * KERNELPAGES;
 			uint32_t flags = masterTile->readWord32(addressInPageTable
 				+ FLAGOFFSET);
-			if (!(flags & 0x01)) {
-				continue;
-			}
-			waitATick();
-			uint64_t storedPage = masterTile->readLong(
-				addressInPageTable + VOFFSET);
 			waitATick();
-			if (pageSought == storedPage) {
-				waitATick();
-				flags |= 0x04;
-				if (flags & 0x08) {
-					flags ^= 0x08;
+			flags |= 0x04;
+			if (flags & 0x08) {
+				flags ^= 0x08;
+				if (options.cooperativeCaching) {
+					unshareFrame(i);
 				}
-				masterTile->writeWord32(addressInPageTable +
-					FLAGOFFSET, flags);
-				waitATick();
-				fixTLB(i, address);
-				waitATick();
-				return fetchAddressWrite(address);
 			}
+			masterTile->writeWord32(addressInPageTable +
+				FLAGOFFSET, flags);
+			waitATick();
+			fixTLB(i, address);
 			waitATick();
+			return fetchAddressWrite(address);
 		}
 		waitATick();
 		return triggerHardFault(address, readOnly, true);
@@ -823,22 +1941,321 @@ uint64_t Processor::fetchAddressWrite(const uint64_t& address)
 //function to mimic delay from read of global page tables
 void Processor::fetchAddressToRegister()
 {
-    emit smallFault();
-    smallFaultCount++;
+    countSmallFault();
     requestRemoteMemory(0x0, 0x0, 0x0, false);
 }
 		
-void Processor::writeAddress(const uint64_t& address,
+void Processor::writeAddress(const uint64_t& untagged,
 	const uint64_t& value)
 {
+	const uint64_t address = tagAddress(untagged);
+	if (options.storeBufferEntries > 0 && mode == VIRTUAL) {
+		bufferStore(address, value);
+		return;
+	}
 	uint64_t fetchedAddress = fetchAddressWrite(address);
 	masterTile->writeLong(fetchedAddress, value);
 }
 
+//merge into the line's entry if there is one - otherwise take a new
+//entry, draining first if none are free
+void Processor::bufferStore(const uint64_t& address, const uint64_t& value)
+{
+	const uint64_t lineAddress = address & bitmapMask;
+	const uint64_t offset = address - lineAddress;
+	//a store running on into the next line would share bytes with
+	//that line's entry - it goes straight to memory, behind the rest
+	if (offset + sizeof(uint64_t) > bitmapBytes) {
+		drainStoreBuffer();
+		masterTile->writeLong(fetchAddressWrite(address), value);
+		return;
+	}
+	storesBuffered++;
+	for (auto& entry: storeBuffer) {
+		if (entry.lineAddress == lineAddress) {
+			entry.merge(offset, value);
+			storesMerged++;
+			return;
+		}
+	}
+	if (storeBuffer.size() >= options.storeBufferEntries) {
+		drainStoreBuffer();
+	}
+	storeBuffer.push_back(StoreBufferEntry(lineAddress, bitmapBytes));
+	storeBuffer.back().merge(offset, value);
+}
+
+//the line's entry holds the last byte stored to each place
+bool Processor::forwardStore(const uint64_t& address, uint8_t& value) const
+{
+	const uint64_t lineAddress = address & bitmapMask;
+	for (auto& entry: storeBuffer) {
+		if (entry.lineAddress == lineAddress) {
+			return entry.forward(address - lineAddress, value);
+		}
+	}
+	return false;
+}
+
+void Processor::writeStoreLine(const StoreBufferEntry& entry,
+	const uint64_t& localLine)
+{
+	for (uint64_t i = 0; i < entry.bytes.size(); i++) {
+		if (entry.written[i]) {
+			masterTile->writeByte(localLine + i, entry.bytes[i]);
+		}
+	}
+}
+
+//send every buffered line to memory in order - faults are taken here
+void Processor::drainStoreBuffer()
+{
+	if (draining || storeBuffer.empty()) {
+		return;
+	}
+	draining = true;
+	storeDrains++;
+	while (!storeBuffer.empty()) {
+		StoreBufferEntry entry = storeBuffer.front();
+		storeBuffer.pop_front();
+		const uint64_t firstOffset = entry.firstWritten();
+		const uint64_t localLine = fetchAddressWrite(
+			entry.lineAddress + firstOffset) - firstOffset;
+		writeStoreLine(entry, localLine);
+	}
+	draining = false;
+}
+
+//retire the oldest line on a spare cycle if it would hit - anything
+//that would fault waits for a drain
+void Processor::retireStoreIdle()
+{
+	const StoreBufferEntry& entry = storeBuffer.front();
+	uint64_t y = 0;
+	for (auto x: tlbs) {
+		if (get<2>(x) && ((entry.lineAddress & pageMask) ==
+			(get<0>(x) & pageMask))) {
+			if (!isBitmapValid(entry.lineAddress, get<1>(x)) ||
+				(localMemory->readWord32((1 << pageShift) *
+				KERNELPAGES + y * PAGETABLEENTRY +
+				FLAGOFFSET) & 0x08)) {
+				return;
+			}
+			const uint64_t localLine = (y << pageShift) +
+				(entry.lineAddress & bitMask) + PAGESLOCAL;
+			writeStoreLine(entry, localLine);
+			markDirtyBitmap(y, entry.lineAddress);
+			notePrefetchUse(y, entry.lineAddress, false);
+			storesRetiredIdle++;
+			storeBuffer.pop_front();
+			return;
+		}
+		y++;
+	}
+}
+
+void Processor::fence()
+{
+	drainStoreBuffer();
+}
+
+//keep the pages of a range resident - those already here are fixed
+//now, the rest as they fault in, for as long as the budget lasts - the
+//directive takes one tick however many pages it covers
+void Processor::pinRange(const uint64_t& address, const uint64_t& size)
+{
+	const uint64_t firstPage = tagAddress(address) & pageMask;
+	const uint64_t lastPage =
+		tagAddress(address + (size > 0 ? size - 1 : 0)) & pageMask;
+	waitATick();
+	for (uint64_t page = firstPage; page <= lastPage;
+		page += (1 << pageShift)) {
+		if (!pinnedPages.insert(page).second) {
+			continue;
+		}
+		for (uint64_t i = 0; i < pagesAvailable; i++) {
+			const uint64_t pte = (1 << pageShift) * KERNELPAGES +
+				i * PAGETABLEENTRY;
+			if ((localMemory->readWord32(pte + FLAGOFFSET) & 0x01)
+				&& localMemory->readLong(pte + VOFFSET) == page) {
+				applyPin(i);
+				break;
+			}
+		}
+	}
+}
+
+void Processor::unpinRange(const uint64_t& address, const uint64_t& size)
+{
+	const uint64_t firstPage = tagAddress(address) & pageMask;
+	const uint64_t lastPage =
+		tagAddress(address + (size > 0 ? size - 1 : 0)) & pageMask;
+	waitATick();
+	for (uint64_t page = firstPage; page <= lastPage;
+		page += (1 << pageShift)) {
+		if (pinnedPages.erase(page) == 0) {
+			continue;
+		}
+		for (uint64_t i = 0; i < pagesAvailable; i++) {
+			const uint64_t pte = (1 << pageShift) * KERNELPAGES +
+				i * PAGETABLEENTRY;
+			const uint32_t flags =
+				localMemory->readWord32(pte + FLAGOFFSET);
+			if ((flags & 0x01) && (flags & 0x02) &&
+				localMemory->readLong(pte + VOFFSET) == page) {
+				localMemory->writeWord32(pte + FLAGOFFSET,
+					flags & ~0x02);
+				pinnedFrames--;
+				break;
+			}
+		}
+	}
+}
+
+//fix the frame if the budget allows - and never the last frame left
+//to page into
+void Processor::applyPin(const uint64_t& frameNo)
+{
+	const uint64_t pte =
+		(1 << pageShift) * KERNELPAGES + frameNo * PAGETABLEENTRY;
+	const uint32_t flags = localMemory->readWord32(pte + FLAGOFFSET);
+	if (flags & 0x02) {
+		return;
+	}
+	if (pinnedFrames >= options.pinBudget ||
+		pinnedFrames + 1 >= freePages) {
+		pinsRefused++;
+		return;
+	}
+	localMemory->writeWord32(pte + FLAGOFFSET, flags | 0x02);
+	pinnedFrames++;
+}
+
+//ask the mesh for a read-only copy of the lines before going up the
+//tree - a miss still waits for the furthest neighbour to answer
+bool Processor::fetchFromNeighbour(const uint64_t& address,
+	const tuple<uint64_t, uint64_t, bool>& tlbEntry,
+	const uint64_t& size)
+{
+	meshQueries++;
+	const uint64_t globalAddress = address & ~ASID_MASK;
+	const long hops = masterTile->findSharer(globalAddress & pageMask,
+		(globalAddress & bitMask) >> bitmapShift, size >> bitmapShift,
+		COOP_MAX_HOPS);
+	if (hops < 0) {
+		waitGlobalTicks(2 * COOP_MAX_HOPS * MESH_HOP_TICKS);
+		return false;
+	}
+	meshHits++;
+	meshHops += hops;
+	//request out, the holder reads its copy, lines stream back
+	const uint64_t meshTicks = 2 * hops * MESH_HOP_TICKS +
+		MESH_SERVICE_TICKS + (size + MESH_LINK_BYTES - 1) /
+		MESH_LINK_BYTES;
+	waitGlobalTicks(meshTicks);
+	//a read-only copy matches global memory, so take the bytes from
+	//there rather than reach into another tile's memory mid-tick
+	for (uint64_t i = 0; i < size; i++) {
+		masterTile->writeByte(get<1>(tlbEntry) +
+			(globalAddress & bitMask) + i,
+			masterTile->readByte(globalAddress + i));
+	}
+	return true;
+}
+
+//read-only lines this tile holds can serve its neighbours' faults
+void Processor::shareLines(const uint64_t& frameNo, const uint64_t& address,
+	const uint64_t& lines)
+{
+	const uint64_t pte = (1 << pageShift) * KERNELPAGES +
+		frameNo * PAGETABLEENTRY;
+	const uint32_t flags = localMemory->readWord32(pte + FLAGOFFSET);
+	if (!(flags & 0x01) || !(flags & 0x08)) {
+		return;
+	}
+	masterTile->shareLines(localMemory->readLong(pte + VOFFSET) &
+		~ASID_MASK, (address & bitMask) >> bitmapShift, lines,
+		(1 << pageShift) >> bitmapShift);
+}
+
+void Processor::unshareFrame(const uint64_t& frameNo)
+{
+	const uint64_t pte = (1 << pageShift) * KERNELPAGES +
+		frameNo * PAGETABLEENTRY;
+	const uint32_t flags = localMemory->readWord32(pte + FLAGOFFSET);
+	if (!(flags & 0x01) || !(flags & 0x08)) {
+		return;
+	}
+	masterTile->unsharePage(localMemory->readLong(pte + VOFFSET) &
+		~ASID_MASK);
+}
+
+//trace addresses take the running context's ASID
+uint64_t Processor::tagAddress(const uint64_t& address) const
+{
+	if (mode != VIRTUAL || (address >> ASID_SHIFT)) {
+		return address;
+	}
+	return address | (currentASID << ASID_SHIFT);
+}
+
+//charge the ticks since the last look to the running context
+void Processor::accountContext()
+{
+	contextStats[currentASID].ticks += totalTicks - tickMark;
+	tickMark = totalTicks;
+}
+
+//a fault goes to the window, the pass and the running context - the
+//context's totals outlive passes other contexts finish
+void Processor::countSmallFault()
+{
+	FaultCounters::count(faults.small);
+	smallFaultCount++;
+	contextStats[currentASID].smallFaults++;
+}
+
+void Processor::countHardFault()
+{
+	FaultCounters::count(faults.hard);
+	hardFaultCount++;
+	contextStats[currentASID].hardFaults++;
+}
+
+//save the outgoing context's registers and load the incoming ones -
+//a switch is a fence, and without tags the user TLB entries go too
+void Processor::switchContext(const uint64_t& asid)
+{
+	if (asid == currentASID) {
+		return;
+	}
+	fence();
+	flushStreamBuffer();
+	accountContext();
+	waitTicks(2 * REGISTER_FILE_SIZE);
+	contextRegisters[currentASID] = registerFile;
+	registerFile = contextRegisters[asid];
+	if (!options.taggedTLB) {
+		waitATick();
+		for (auto& x: tlbs) {
+			if (get<0>(x) < PAGESLOCAL) {
+				get<2>(x) = false;
+			}
+		}
+		tlbFlushes++;
+	}
+	lastPrefetchLine = 0;
+	prefetchStride = 0;
+	prefetchConfidence = 0;
+	currentASID = asid;
+	contextSwitches++;
+	contextStats[asid].switches++;
+}
+
 void Processor::writeAddress64(const uint64_t& address)
 {
 	writeAddress(address, 0);
-	if ((address + 7) % BITMAP_BYTES < address % BITMAP_BYTES) {
+	if ((address + 7) % bitmapBytes < address % bitmapBytes) {
 		writeAddress(address + 7, 0);
 	}
 }
@@ -846,7 +2263,7 @@ void Processor::writeAddress64(const uint64_t& address)
 void Processor::writeAddress32(const uint64_t& address)
 {
 	writeAddress(address, 0);
-	if ((address + 3) % BITMAP_BYTES < address % BITMAP_BYTES ) {
+	if ((address + 3) % bitmapBytes < address % bitmapBytes ) {
 		writeAddress(address + 3, 0);
 	}
 }
@@ -854,7 +2271,7 @@ void Processor::writeAddress32(const uint64_t& address)
 void Processor::writeAddress16(const uint64_t& address)
 {
 	writeAddress(address, 0);
-	if ((address + 1) % BITMAP_BYTES == 0) {
+	if ((address + 1) % bitmapBytes == 0) {
 		writeAddress(address + 1, 0);
 	}
 }
@@ -869,15 +2286,28 @@ uint64_t Processor::getLongAddress(const uint64_t& address)
 	return masterTile->readLong(fetchAddressRead(address));
 }
 
-uint8_t Processor::getAddress(const uint64_t& address, const long& count)
+uint8_t Processor::getAddress(const uint64_t& untagged, const long& count)
 {
-	uint8_t retValue = masterTile->readByte(fetchAddressRead(address));
+	const uint64_t address = tagAddress(untagged);
+	uint8_t retValue = 0;
+	if (forwardStore(address, retValue)) {
+		storeForwards++;
+	} else {
+		retValue = masterTile->readByte(
+			fetchAddressRead(address, true, false, true));
+	}
 	if (count > 1) {
-		uint position = address % BITMAP_BYTES;
-		uint newPosition = (address + count - 1) % BITMAP_BYTES;
+		uint position = address % bitmapBytes;
+		uint newPosition = (address + count - 1) % bitmapBytes;
 		if (newPosition <= position) {
-			retValue = masterTile->readByte(
-				fetchAddressRead(newPosition));
+			const uint64_t nextAddress = tagAddress(newPosition);
+			if (forwardStore(nextAddress, retValue)) {
+				storeForwards++;
+			} else {
+				retValue = masterTile->readByte(
+					fetchAddressRead(nextAddress,
+					true, false, true));
+			}
 		}
 	}
 	return retValue;
@@ -933,39 +2363,205 @@ void Processor::pcAdvance(const long count)
 		return;
 	}
 	//check if we are going over a boundary
-	uint position = programCounter % BITMAP_BYTES;
-	uint updatePosition = (programCounter + count - 1) % BITMAP_BYTES;
+	uint position = programCounter % bitmapBytes;
+	uint updatePosition = (programCounter + count - 1) % bitmapBytes;
 	if (updatePosition <= position) {
 		programCounter += count;
-		fetchAddressRead(programCounter);
+		fetchAddressRead(programCounter, true, false, false, true);
 	}
 }
 
-void Processor::setProgramCounter(const uint64_t& address)
+void Processor::setProgramCounter(const uint64_t& untagged)
 {
+	const uint64_t address = tagAddress(untagged);
+	//a jump leaves the stream behind
+	const uint64_t currentLine = programCounter & bitmapMask;
+	const uint64_t nextLine = address & bitmapMask;
+	if (nextLine != currentLine && nextLine != currentLine + bitmapBytes) {
+		flushStreamBuffer();
+	}
 	programCounter = address;
-	fetchAddressRead(address);
+	fetchAddressRead(address, true, false, false, true);
 }
 
 void Processor::waitATick()
 {
+	if (deferTicks(1)) {
+		return;
+	}
+	synchronise();
+	ControlThread *pBarrier = masterTile->getBarrier();
+	pBarrier->releaseToRun(masterTile->getOrder());
+	accountTicks(1);
+}
+
+//sit out a pure delay without taking part in every barrier round
+void Processor::waitTicks(const uint64_t& count)
+{
+	if (count == 0 || deferTicks(count)) {
+		return;
+	}
+	synchronise();
+	holdTicks(count);
+}
+
+void Processor::holdTicks(const uint64_t& count)
+{
+	ControlThread *pBarrier = masterTile->getBarrier();
+	uint64_t left = count;
+	while (left > 0) {
+		const uint64_t span = min(left, ticksToDeadline());
+		pBarrier->waitTicks(masterTile->getOrder(), span);
+		accountTicks(span);
+		left -= span;
+	}
+}
+
+//a span of ticks stops at the next clock or cleaner tick, so each runs
+//on the tick it would if the span were waited out one tick at a time
+uint64_t Processor::ticksToDeadline() const
+{
+	const uint64_t toClock = clockTicks - totalTicks % clockTicks;
+	const uint64_t toCleaner = cleanerTicks - totalTicks % cleanerTicks;
+	return min(toClock, toCleaner);
+}
+
+//run ahead of the barrier - never while a packet is in the tree or a
+//carrier may land, as both are timed against the other tiles
+bool Processor::deferTicks(const uint64_t& count)
+{
+	if (!options.lookaheadQuanta || routingDepth > 0 ||
+		!backgroundFetches.empty()) {
+		return false;
+	}
+	if (lead + count >= LOOKAHEAD_QUANTUM) {
+		if (lead == 0 || !masterTile->getBarrier()->runsAhead()) {
+			return false;
+		}
+		publishLead();
+	}
+	uint64_t left = count;
+	while (left > 0) {
+		const uint64_t span = min(left, ticksToDeadline());
+		lead += span;
+		accountTicks(span);
+		left -= span;
+	}
+	return true;
+}
+
+//let the rest of the tiles run on to our clock while we carry on
+void Processor::publishLead()
+{
+	ControlThread *pBarrier = masterTile->getBarrier();
+	if (aheadWake == 0) {
+		aheadWake = pBarrier->runAhead(masterTile->getOrder(), lead);
+		aheadWindows++;
+	} else {
+		pBarrier->extendRunAhead(masterTile->getOrder(), aheadWake,
+			lead);
+	}
+	aheadTicks += lead;
+	lead = 0;
+	const uint64_t barrierTick = pBarrier->currentTick();
+	const uint64_t depth =
+		aheadWake > barrierTick ? aheadWake - barrierTick : 0;
+	aheadDepth += depth;
+	aheadSamples++;
+	if (depth > aheadDeepest) {
+		aheadDeepest = depth;
+	}
+}
+
+//let the barrier catch up with the ticks already run ahead, so what
+//comes next happens on the same tick as under lockstep
+void Processor::synchronise()
+{
+	if (lead == 0 && aheadWake == 0) {
+		return;
+	}
+	const uint64_t behind = lead;
+	lead = 0;
 	ControlThread *pBarrier = masterTile->getBarrier();
-	pBarrier->releaseToRun();
-	totalTicks++;
-	if (totalTicks%clockTicks == 0) {
+	if (aheadWake == 0) {
+		pBarrier->waitTicks(masterTile->getOrder(), behind);
+		return;
+	}
+	aheadTicks += behind;
+	const uint64_t wake = aheadWake;
+	aheadWake = 0;
+	pBarrier->catchUp(masterTile->getOrder(), wake, behind);
+}
+
+//the per-tick work for ticks just passed - idle store retirement gets
+//one entry a tick
+void Processor::accountTicks(const uint64_t& count)
+{
+	if (!backgroundFetches.empty() && !inInterrupt) {
+		retireBackgroundFetches();
+	}
+	for (uint64_t i = 0; i < count; i++) {
+		if (storeBuffer.empty() || inInterrupt || draining) {
+			break;
+		}
+		const uint64_t buffered = storeBuffer.size();
+		retireStoreIdle();
+		if (storeBuffer.size() == buffered) {
+			break;
+		}
+	}
+	const uint64_t ticksBefore = totalTicks;
+	totalTicks += count;
+	if (inInterrupt) {
+		if (savingRegisters) {
+			saveTicks += count;
+		} else {
+			handlerTicks += count;
+		}
+	}
+	mshrOccupancy += mshrsInUse * count;
+	mshrSamples += count;
+	if (mshrsInUse > mshrPeak) {
+		mshrPeak = mshrsInUse;
+	}
+	if (totalTicks / clockTicks != ticksBefore / clockTicks) {
 		clockDue = true;
-	}	
+	}
 	if (clockDue && inClock == false) {
 		clockDue = false;
 		activateClock();
 	}
+	if (totalTicks / cleanerTicks != ticksBefore / cleanerTicks) {
+		cleanerDue = true;
+	}
+	if (cleanerDue && !inInterrupt) {
+		cleanerDue = false;
+		runCleaner();
+	}
 }
 
 void Processor::waitGlobalTick()
 {
-    	for (uint64_t i = 0; i < GLOBALCLOCKSLOW; i++) {
-		waitATick();
-	}
+	waitTicks(GLOBALCLOCKSLOW);
+}
+
+//tree and mesh time is shared - never run ahead of it
+void Processor::waitGlobalTicks(const uint64_t& count)
+{
+	synchronise();
+	holdTicks(count * GLOBALCLOCKSLOW);
+}
+
+//ticks for a carrier thread - the processor's own clock is left alone
+void Processor::waitBackgroundTick()
+{
+	waitBackgroundTicks(1);
+}
+
+void Processor::waitBackgroundTicks(const uint64_t& count)
+{
+	ControlThread *pBarrier = masterTile->getBarrier();
+	pBarrier->waitTicks(masterTile->getOrder(), count * GLOBALCLOCKSLOW);
 }
 
 void Processor::pushStackPointer()
@@ -991,11 +2587,17 @@ void Processor::activateClock()
 	if (inInterrupt) {
 		return;
 	}
+	//the clock can arrive part way through a translation, where the
+	//faults of a drain could take the frame being translated - so it
+	//waits for the stores to go
+	if (!storeBuffer.empty()) {
+		clockDue = true;
+		return;
+	}
 	inClock = true;
-	uint64_t pages = TILE_MEM_SIZE >> pageShift;
 	interruptBegin();
 	int wiped = 0;
-	for (uint8_t i = 0; i < pages; i++) {
+	for (uint64_t i = 0; i < pagesAvailable; i++) {
 		waitATick();
 		uint64_t flagAddress = (1 << pageShift) * KERNELPAGES 
 			+ PAGESLOCAL + FLAGOFFSET +
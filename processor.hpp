@@ -4,11 +4,14 @@
 #include <fstream>
 #include <vector>
 #include <map>
+#include <set>
 #include <string>
 #include <thread>
 #include <bitset>
 #include <mutex>
 #include <tuple>
+#include <list>
+#include <atomic>
 #include <condition_variable>
 #include <climits>
 #include <cstdlib>
@@ -18,6 +21,7 @@
 #include "mux.hpp"
 #include "tile.hpp"
 #include "memory.hpp"
+#include "storebuffer.hpp"
 
 
 #ifndef _PROCESSOR_CLASS_
@@ -33,29 +37,119 @@
 #define ENDOFFSET 28
 
 static const uint64_t REGISTER_FILE_SIZE = 32;
-static const uint64_t BITMAP_BYTES = 16;
+//default sub-page line - the real size is set in createMemoryMap
 static const uint64_t BITMAP_SHIFT = 4;
-static const uint64_t BITMAP_MASK = 0xFFFFFFFFFFFFFFF0;
+//adaptive fetch (when switched on): widen a frame's fetch block 4x
+//after two small faults in adjacent blocks, narrow it on a scattered
+//fault
+static const uint64_t FETCH_WIDEN_AFTER = 2;
+static const uint64_t FETCH_STEP_SHIFT = 2;
+//stride prefetch (when switched on): after PREFETCH_CONFIDENCE repeats
+//of the same stride between small faults or prefetch hits fetch
+//PREFETCH_DEGREE strides ahead in background
+static const uint64_t PREFETCH_CONFIDENCE = 1;
+static const uint64_t PREFETCH_DEGREE = 2;
+static const uint64_t MAX_BACKGROUND_FETCHES = 4;
+//registers a handler uses, spilled under SAVE_LAZY
+static const uint64_t HANDLER_REGISTERS = 4;
+//hashed page table walker (when switched on) - TLB misses probe at
+//most HASH_PROBES slots of a hash of virtual pages to frames kept
+//beside the bitmaps
+static const uint64_t HASH_PROBES = 8;
+static const uint64_t HASH_EMPTY = 0;
+static const uint64_t HASH_TOMBSTONE = ~0ULL;
+//multi-programmed tiles - each context replays its own trace for a
+//quantum of ticks, its ASID kept in bits 48 to 55 of virtual addresses
+//in the PTEs and TLBs
+static const uint64_t CONTEXT_QUANTUM = 20000;
+static const uint64_t ASID_SHIFT = 48;
+static const uint64_t ASID_MASK = 0xFFULL << ASID_SHIFT;
+//with cooperative caching (-o) hard faults on read-only pages first ask
+//tiles up to COOP_MAX_HOPS away on the mesh for a copy - each hop costs
+//MESH_HOP_TICKS each way
+static const uint64_t COOP_MAX_HOPS = 2;
+static const uint64_t MESH_HOP_TICKS = 2;
+static const uint64_t MESH_SERVICE_TICKS = 4;
+static const uint64_t MESH_LINK_BYTES = 8;
 //page mappings
 static const uint64_t PAGESLOCAL = 0xA000000000000000;
 static const uint64_t GLOBALCLOCKSLOW = 1;
-static const uint64_t TOTAL_LOCAL_PAGES = TILE_MEM_SIZE >> PAGE_SHIFT;
 static const uint64_t BITS_PER_BYTE = 8;
 
 class Tile;
+class Processor;
+
+//lines travelling through the tree on their own thread while the
+//processor carries on - the processor retires them when they land
+//(writes are the cleaner's, carrying lines that reach global memory
+//when the packet does)
+class BackgroundFetch {
+public:
+	BackgroundFetch(Processor *proc, const uint64_t& frame,
+		const uint64_t& page, const uint64_t& addr,
+		const uint64_t& local, const uint64_t& count,
+		const uint64_t& size, const bool& wr = false,
+		const bool& dem = false, const bool& str = false):
+		packet(proc, addr & ~ASID_MASK, local, size), carrier(nullptr),
+		arrived(false), arrivalTick(0), frameNo(frame), pageAddress(page),
+		address(addr), lines(count), write(wr), demand(dem),
+		stream(str)
+	{
+		packet.setBackground();
+		if (write) {
+			packet.setWrite();
+		}
+	}
+	MemoryPacket packet;
+	std::thread *carrier;
+	std::atomic<bool> arrived;
+	//set before arrived under deterministic arbitration - the lines are
+	//usable from the tick after
+	uint64_t arrivalTick;
+	const uint64_t frameNo;
+	const uint64_t pageAddress;
+	const uint64_t address;
+	const uint64_t lines;
+	const bool write;
+	const bool demand;
+	const bool stream;
+};
+
+//what one context has cost its tile
+class ContextStats {
+public:
+	ContextStats(): hardFaults(0), smallFaults(0), ticks(0),
+		switches(0) {}
+	uint64_t hardFaults;
+	uint64_t smallFaults;
+	uint64_t ticks;
+	uint64_t switches;
+};
 
 class Processor: public QObject {
     Q_OBJECT
 
-signals:
-    void hardFault();
-    void smallFault();
-
 private:
-	std::mutex interruptLock;
-	std::mutex waitMutex;
 	std::vector<uint64_t> registerFile;
+	std::vector<uint64_t> shadowRegisters;
+	std::vector<std::vector<uint64_t>> contextRegisters;
+	uint64_t currentASID;
+	uint64_t tickMark;
+	std::set<uint64_t> pinnedPages;
 	std::vector<std::tuple<uint64_t, uint64_t, bool>> tlbs;
+	std::vector<uint64_t> fetchShift;
+	std::vector<uint64_t> lastFaultOffset;
+	std::vector<uint64_t> adjacentFaults;
+	std::list<BackgroundFetch *> backgroundFetches;
+	std::vector<std::vector<bool>> prefetchedLines;
+	uint64_t lastPrefetchLine;
+	int64_t prefetchStride;
+	uint64_t prefetchConfidence;
+	uint64_t mshrsInUse;
+	std::list<StoreBufferEntry> storeBuffer;
+	bool draining;
+	std::list<BackgroundFetch *> streamBuffer;
+	uint64_t streamNextLine;
 	bool carryBit;
 	uint64_t programCounter;
 	Tile *masterTile;
@@ -63,35 +157,118 @@ private:
 	ProcessorMode mode;
 	Memory *localMemory;
 	MainWindow *mainWindow;
+	const ProcessorOptions options;
+	FaultCounters faults;
 	long pageShift;
 	uint64_t stackPointer;
 	uint64_t stackPointerOver;
 	uint64_t stackPointerUnder;
 	uint64_t pageMask;
 	uint64_t bitMask;
+	uint64_t bitmapShift;
+	uint64_t bitmapBytes;
+	uint64_t bitmapMask;
+	uint64_t bitmapSizeBytes;
+	uint64_t hashTableOffset;
+	uint64_t hashSlots;
+	uint64_t hashOverflows;
 	uint64_t memoryAvailable;
 	uint64_t pagesAvailable;
 	uint64_t processorNumber;
 	uint64_t randomPage;
+	uint64_t basePages;
+	uint64_t freePages;
 	bool inInterrupt;
+	bool savingRegisters;
 	bool inClock;
 	bool clockDue;
+	//ticks accounted but not yet waited out at the barrier
+	uint64_t lead;
+	uint64_t routingDepth;
+	uint64_t packetsIssued;
+	//the tick the barrier waits for us on while we run ahead, or 0
+	uint64_t aheadWake;
+	bool deferTicks(const uint64_t& count);
+	void publishLead();
+	void holdTicks(const uint64_t& count);
+	uint64_t ticksToDeadline() const;
 	void markUpBasicPageEntries(const uint64_t& reqPTEPages,
-		const uint64_t& reqBitmapPages);
+		const uint64_t& reqBitmapPages, const uint64_t& reqHashPages);
 	void writeOutBasicPageEntries(const uint64_t& reqPTEPages);
 	void writeOutPageAndBitmapLengths(const uint64_t& reqPTESize,
 		const uint64_t& reqBitmapPages);
 	void zeroOutTLBs(const uint64_t& reqPTEPages);
+	uint64_t tagAddress(const uint64_t& address) const;
+	void applyPin(const uint64_t& frameNo);
+	void accountTicks(const uint64_t& count);
+	void countSmallFault();
+	void countHardFault();
+	bool fetchFromNeighbour(const uint64_t& address,
+		const std::tuple<uint64_t, uint64_t, bool>& tlbEntry,
+		const uint64_t& size);
+	void shareLines(const uint64_t& frameNo, const uint64_t& address,
+		const uint64_t& lines);
+	void unshareFrame(const uint64_t& frameNo);
+	uint64_t hashSlot(const uint64_t& pageAddress,
+		const uint64_t& probe) const;
+	bool hashLookup(const uint64_t& pageAddress, uint64_t& frameNo);
+	void hashInsert(const uint64_t& pageAddress, const uint64_t& frameNo,
+		const bool& timed = true);
+	void hashRemove(const uint64_t& pageAddress, const uint64_t& frameNo,
+		const bool& timed = true);
+	bool walkPageTable(const uint64_t& pageSought, uint64_t& frameNo);
 	uint64_t fetchAddressRead(const uint64_t& address,
-		const bool& readOnly = true, const bool& write = false);
+		const bool& readOnly = true, const bool& write = false,
+		const bool& load = false, const bool& instruction = false);
     	uint64_t fetchAddressWrite(const uint64_t& address);
 	bool isBitmapValid(const uint64_t& address,
 		const uint64_t& physAddress) const;
+	uint64_t dirtyBitmapOffset() const;
 	uint64_t generateAddress(const uint64_t& frame,
 		const uint64_t& address);
     	uint64_t triggerSmallFault(
         const std::tuple<uint64_t, uint64_t, bool>& tlbEntry,
-        	const uint64_t& address, const bool& write);
+        	const uint64_t& address, const bool& write,
+		const bool& readOnly = true, const bool& load = false);
+	void bufferStore(const uint64_t& address, const uint64_t& value);
+	bool forwardStore(const uint64_t& address, uint8_t& value) const;
+	void drainStoreBuffer();
+	void writeStoreLine(const StoreBufferEntry& entry,
+		const uint64_t& localLine);
+	void retireStoreIdle();
+	uint64_t triggerLoadMiss(
+		const std::tuple<uint64_t, uint64_t, bool>& tlbEntry,
+		const uint64_t& address);
+	void fetchLines(const uint64_t& frameNo,
+		const std::tuple<uint64_t, uint64_t, bool>& tlbEntry,
+		const uint64_t& address, const uint64_t& lines);
+	void adaptFetchGranularity(const uint64_t& frameNo,
+		const uint64_t& address);
+	bool issueBackgroundFetch(const uint64_t& frameNo,
+		const std::tuple<uint64_t, uint64_t, bool>& tlbEntry,
+		const uint64_t& address, const uint64_t& lines,
+		const bool& demand = false);
+	bool launchBackground(BackgroundFetch *fetch);
+	void landFetch(BackgroundFetch *fetch);
+	bool landed(const BackgroundFetch *fetch) const;
+	void retireBackgroundFetches();
+	bool streamBufferHit(const uint64_t& address);
+	void streamBufferAllocate(const uint64_t& address);
+	void streamBufferTopUp();
+	void flushStreamBuffer();
+	bool backgroundFetchPending(const uint64_t& frameNo,
+		const uint64_t& address) const;
+	void stridePrefetch(const uint64_t& address);
+	void prefetchBlock(const uint64_t& frameNo,
+		const std::tuple<uint64_t, uint64_t, bool>& tlbEntry,
+		const uint64_t& address);
+	void notePrefetchUse(const uint64_t& frameNo,
+		const uint64_t& address, const bool& train = true);
+	bool frameDirty(const uint64_t& frameNo) const;
+	void cleanFrame(const uint64_t& frameNo, uint64_t& budget);
+	bool cleanerWritePending(const uint64_t& frameNo) const;
+	void settleCleanerWrites(const uint64_t& frameNo);
+	void runCleaner();
 	void interruptBegin();
 	void interruptEnd();
 	void transferGlobalToLocal(const uint64_t& address,
@@ -112,6 +289,10 @@ private:
         	const uint64_t& address);
 	void markBitmap(const uint64_t& frameNo,
         	const uint64_t& address);
+	void markDirtyBitmap(const uint64_t& frameNo,
+		const uint64_t& address);
+	void clearDirtyBitmap(const uint64_t& frameNo,
+		const uint64_t& address);
 	void fixTLB(const uint64_t& frameNo,
 		const uint64_t& address);
 	const std::vector<uint8_t>
@@ -125,17 +306,28 @@ private:
 	//adjust numbers below to change how CLOCK fuctions
     	const uint8_t clockWipe = 1;
     	const uint16_t clockTicks = 1000;
+	//adjust numbers below to change how hard the cleaner works - it
+	//wakes every cleanerTicks and writes back at most cleanerLines
+	//dirty lines of cold frames, until cleanerPool clean victims wait
+	const uint16_t cleanerTicks = 250;
+	const uint16_t cleanerLines = 16;
+	const uint16_t cleanerPool = 2;
+	uint64_t cleanerHand;
+	bool cleanerDue;
 	uint64_t totalTicks;
 	uint64_t currentTLB;
 
 public:
 	std::bitset<16> statusWord;
-    	Processor(Tile* parent, MainWindow *mW, uint64_t numb);
+    	Processor(Tile* parent, MainWindow *mW, uint64_t numb,
+		const ProcessorOptions& opts);
+	~Processor();
 	void loadMem(const long regNo, const uint64_t memAddr);
 	void switchModeReal();
 	void switchModeVirtual();
 	void setMode();
-	void createMemoryMap(Memory *local, long pShift);
+	void createMemoryMap(Memory *local, long pShift,
+		long lShift = BITMAP_SHIFT);
 	void setPCNull();
 	void start();
 	void pcAdvance(const long count = sizeof(long));
@@ -169,7 +361,19 @@ public:
         const std::tuple<uint64_t, uint64_t, bool>& tlbEntry,
        		const uint64_t& size);
 	void waitATick();
+	void waitTicks(const uint64_t& count);
 	void waitGlobalTick();
+	void waitGlobalTicks(const uint64_t& count);
+	void waitBackgroundTick();
+	void waitBackgroundTicks(const uint64_t& count);
+	void synchronise();
+	void fence();
+	void switchContext(const uint64_t& asid);
+	void pinRange(const uint64_t& address, const uint64_t& size);
+	void unpinRange(const uint64_t& address, const uint64_t& size);
+	void accountContext();
+	uint64_t contextCount() const { return options.contexts; }
+	std::vector<ContextStats> contextStats;
 	Tile* getTile() const { return masterTile; }
    	uint64_t getNumber() { return processorNumber; }
    	void flushPagesStart();
@@ -178,11 +382,55 @@ public:
     	void dumpPageFromTLB(const uint64_t& address);
     	const uint64_t& getTicks() const { return totalTicks; }
 	void incrementBlocks();
-        void incrementServiceTime();
+        void incrementServiceTime(const uint64_t& count);
         void resetCounters();
     	uint64_t hardFaultCount;
     	uint64_t smallFaultCount;
-    	uint64_t blocks;
-    	uint64_t serviceTime;
+    	std::atomic<uint64_t> blocks;
+    	std::atomic<uint64_t> serviceTime;
+	uint64_t cleanLinesSkipped;
+	uint64_t dirtyLinesWritten;
+	uint64_t burstsWritten;
+	uint64_t linesFetched;
+	uint64_t fetchWidenings;
+	uint64_t fetchNarrowings;
+	uint64_t prefetchLines;
+	uint64_t prefetchHits;
+	uint64_t demandMisses;
+	uint64_t linesCleaned;
+	uint64_t cleanVictims;
+	uint64_t mshrOccupancy;
+	uint64_t mshrSamples;
+	uint64_t mshrPeak;
+	uint64_t mshrMerges;
+	uint64_t mshrFullStalls;
+	uint64_t storesBuffered;
+	uint64_t storesMerged;
+	uint64_t storeForwards;
+	uint64_t storeDrains;
+	uint64_t storesRetiredIdle;
+	uint64_t streamHits;
+	uint64_t streamMisses;
+	uint64_t streamLate;
+	uint64_t streamFlushes;
+	uint64_t handlerTicks;
+	uint64_t saveTicks;
+	uint64_t tableWalks;
+	uint64_t walkProbes;
+	uint64_t walkFallbacks;
+	uint64_t contextSwitches;
+	uint64_t tlbFlushes;
+	uint64_t pinnedFrames;
+	uint64_t pinsRefused;
+	uint64_t meshQueries;
+	uint64_t meshHits;
+	uint64_t meshHops;
+	uint64_t aheadWindows;
+	uint64_t aheadTicks;
+	//how far our clock was past the barrier's when each lead was
+	//published
+	uint64_t aheadDeepest;
+	uint64_t aheadDepth;
+	uint64_t aheadSamples;
 };
 #endif
@@ -0,0 +1,49 @@
+//Store buffer entry class
+#include <cstdint>
+#include <vector>
+#ifndef _STOREBUFFER_CLASS_
+#define _STOREBUFFER_CLASS_
+
+//stores waiting to go to one line - the bytes they wrote, in program
+//order, so a later store overwrites whatever an earlier one left in
+//the bytes they share, and a mask of which bytes have been written
+class StoreBufferEntry {
+public:
+	uint64_t lineAddress;
+	std::vector<uint8_t> bytes;
+	std::vector<bool> written;
+
+	StoreBufferEntry(const uint64_t& line, const uint64_t& lineBytes):
+		lineAddress(line), bytes(lineBytes, 0),
+		written(lineBytes, false) {}
+
+	//a store must fit in the line - little endian, as Memory lays
+	//out a long
+	void merge(const uint64_t& offset, const uint64_t& value)
+	{
+		for (uint64_t i = 0; i < sizeof(uint64_t); i++) {
+			bytes[offset + i] = (value >> (i * 8)) & 0xFF;
+			written[offset + i] = true;
+		}
+	}
+
+	bool forward(const uint64_t& offset, uint8_t& value) const
+	{
+		if (offset >= written.size() || !written[offset]) {
+			return false;
+		}
+		value = bytes[offset];
+		return true;
+	}
+
+	uint64_t firstWritten() const
+	{
+		uint64_t offset = 0;
+		while (offset < written.size() && !written[offset]) {
+			offset++;
+		}
+		return offset;
+	}
+};
+
+#endif
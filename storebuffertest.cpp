@@ -0,0 +1,95 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include "storebuffer.hpp"
+
+//overlapping, unaligned stores into one store buffer line must leave
+//the same bytes as the stores made one after another straight to
+//memory - build with g++ -std=c++11 -o storebuffertest storebuffertest.cpp
+
+#define LINE_BYTES 16
+
+using namespace std;
+
+//what memory holds after the stores in program order
+void storeInOrder(vector<uint8_t>& memory, const uint64_t offset,
+	const uint64_t value)
+{
+	for (uint64_t i = 0; i < sizeof(uint64_t); i++) {
+		memory[offset + i] = (value >> (i * 8)) & 0xFF;
+	}
+}
+
+bool check(const char *name,
+	const vector<pair<uint64_t, uint64_t> >& stores,
+	const bool report = true)
+{
+	StoreBufferEntry entry(0, LINE_BYTES);
+	vector<uint8_t> memory(LINE_BYTES, 0);
+	vector<bool> touched(LINE_BYTES, false);
+	for (auto store: stores) {
+		entry.merge(store.first, store.second);
+		storeInOrder(memory, store.first, store.second);
+		for (uint64_t i = 0; i < sizeof(uint64_t); i++) {
+			touched[store.first + i] = true;
+		}
+	}
+	//a drain writes the bytes held over what memory had before
+	vector<uint8_t> drained(LINE_BYTES, 0);
+	for (uint64_t i = 0; i < LINE_BYTES; i++) {
+		if (entry.written[i]) {
+			drained[i] = entry.bytes[i];
+		}
+	}
+	bool passed = true;
+	for (uint64_t i = 0; i < LINE_BYTES; i++) {
+		uint8_t forwarded = 0;
+		const bool found = entry.forward(i, forwarded);
+		if (found != touched[i] || (found && forwarded != memory[i]) ||
+			drained[i] != memory[i]) {
+			cout << name << ": byte " << i << " wrong" << endl;
+			passed = false;
+		}
+	}
+	if (passed && report) {
+		cout << name << ": passed" << endl;
+	}
+	return passed;
+}
+
+int main()
+{
+	bool passed = true;
+	//the younger store is at the lower offset
+	passed &= check("younger below older", {
+		{4, 0x1111111111111111ULL}, {0, 0x2222222222222222ULL}});
+	//the younger store is at the higher offset
+	passed &= check("younger above older", {
+		{0, 0x1111111111111111ULL}, {3, 0x2222222222222222ULL}});
+	//a store inside two others
+	passed &= check("three overlapping", {
+		{1, 0x0102030405060708ULL}, {8, 0x1112131415161718ULL},
+		{5, 0x2122232425262728ULL}});
+	//the same place twice
+	passed &= check("same offset", {
+		{6, 0xAAAAAAAAAAAAAAAAULL}, {6, 0x5555555555555555ULL}});
+	default_random_engine generator;
+	uniform_int_distribution<uint64_t> offsets(0,
+		LINE_BYTES - sizeof(uint64_t));
+	uniform_int_distribution<uint64_t> values;
+	for (int i = 0; i < 1000; i++) {
+		vector<pair<uint64_t, uint64_t> > stores;
+		for (int j = 0; j < 6; j++) {
+			stores.push_back(pair<uint64_t, uint64_t>(
+				offsets(generator), values(generator)));
+		}
+		if (!check("random", stores, false)) {
+			passed = false;
+			break;
+		}
+	}
+	if (passed) {
+		cout << "random: passed" << endl;
+	}
+	return passed ? 0 : 1;
+}
@@ -20,13 +20,14 @@
 using namespace std;
 
 Tile::Tile(Noc* n, const long c, const long r, const long pShift,
-        MainWindow *mW, uint64_t numb):
-        tileLocalMemory{new Memory(0, TILE_MEM_SIZE)},
+        const long lShift, const uint64_t memSize, MainWindow *mW,
+	uint64_t numb, const ProcessorOptions& options):
+        tileLocalMemory{new Memory(0, memSize)},
         coordinates{pair<const long, const long>(c, r)}, parentBoard{n},
-    	mainWindow(mW)
+    	mainWindow(mW), tileProcessor(nullptr)
 {
-    tileProcessor = new Processor(this, mainWindow, numb);
-	tileProcessor->createMemoryMap(tileLocalMemory, pShift);
+    tileProcessor = new Processor(this, mainWindow, numb, options);
+	tileProcessor->createMemoryMap(tileLocalMemory, pShift, lShift);
 }
 
 Tile::~Tile()
@@ -57,6 +58,7 @@ uint8_t Tile::readByte(const uint64_t& address) const
 {
 	if (address < PAGESLOCAL || address > PAGESLOCAL +
 		tileLocalMemory->getSize() - 1) {
+		catchUp();
 		return (parentBoard->getGlobal())[0].readByte(address);
 	} else {
 		return tileLocalMemory->readByte(address - PAGESLOCAL);
@@ -68,6 +70,7 @@ uint64_t Tile::readLong(const uint64_t& address) const
 {
 	if (address < PAGESLOCAL || address > PAGESLOCAL +
 		tileLocalMemory->getSize() - 1) {
+		catchUp();
 		return (parentBoard->getGlobal())[0].readLong(address);
 	} else {
 		return tileLocalMemory->readLong(address - PAGESLOCAL);
@@ -78,6 +81,7 @@ uint32_t Tile::readWord32(const uint64_t& address) const
 {
 	if (address < PAGESLOCAL || address > PAGESLOCAL +
 		tileLocalMemory->getSize() - 1) {
+		catchUp();
 		return (parentBoard->getGlobal())[0].readWord32(address);
 	} else {
 		return tileLocalMemory->readWord32(address - PAGESLOCAL);
@@ -88,6 +92,7 @@ void Tile::writeWord32(const uint64_t& address, const uint32_t& value) const
 {
 	if (address < PAGESLOCAL || address > PAGESLOCAL +
 		tileLocalMemory->getSize() - 1) {
+		catchUp();
 		(parentBoard->getGlobal())[0].writeWord32(address, value);
 	} else {
 		tileLocalMemory->writeWord32(address - PAGESLOCAL, value);
@@ -98,6 +103,7 @@ void Tile::writeByte(const uint64_t& address, const uint8_t& value) const
 {
 	if (address < PAGESLOCAL || address > PAGESLOCAL +
 		tileLocalMemory->getSize() - 1) {
+		catchUp();
 		(parentBoard->getGlobal())[0].writeByte(address, value);
 	} else {
 		tileLocalMemory->writeByte(address - PAGESLOCAL, value);
@@ -109,6 +115,7 @@ void Tile::writeLong(const uint64_t& address, const uint64_t& value)
 {
 	if (address < PAGESLOCAL || address >= PAGESLOCAL +
 		tileLocalMemory->getSize()) {
+		catchUp();
 		(parentBoard->getGlobal())[0].writeLong(address, value);
 	} else {
 		return tileLocalMemory->writeLong(address - PAGESLOCAL,
@@ -116,7 +123,42 @@ void Tile::writeLong(const uint64_t& address, const uint64_t& value)
 	}
 }
 
+//global memory is shared, so the processor may not be running ahead
+void Tile::catchUp() const
+{
+	if (tileProcessor) {
+		tileProcessor->synchronise();
+	}
+}
+
 ControlThread* Tile::getBarrier()
 {
 	return parentBoard->getBarrier();
 }
+
+bool Tile::isDeterministic() const
+{
+	return parentBoard->isDeterministic();
+}
+
+void Tile::shareLines(const uint64_t page, const uint64_t firstLine,
+	const uint64_t lines, const uint64_t linesPerPage)
+{
+	catchUp();
+	parentBoard->shareLines(getOrder(), page, firstLine, lines,
+		linesPerPage);
+}
+
+void Tile::unsharePage(const uint64_t page)
+{
+	catchUp();
+	parentBoard->unsharePage(getOrder(), page);
+}
+
+long Tile::findSharer(const uint64_t page, const uint64_t firstLine,
+	const uint64_t lines, const uint64_t maxHops)
+{
+	catchUp();
+	return parentBoard->findSharer(getOrder(), page, firstLine, lines,
+		maxHops);
+}
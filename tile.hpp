@@ -1,3 +1,4 @@
+//default local memory - each tile's real size is set at start up
 #define TILE_MEM_SIZE (16 * 1024)
 #ifndef _TILE_CLASS_
 #define _TILE_CLASS_
@@ -15,10 +16,12 @@ private:
 	std::vector<std::pair<long, long> > connections;
 	Noc *parentBoard;
 	MainWindow *mainWindow;
+	void catchUp() const;
 
 public:
     	Tile(Noc* parent, const long col, const long r, const long pShift,
-        	MainWindow *mW, uint64_t numb);
+        	const long lShift, const uint64_t memSize, MainWindow *mW,
+		uint64_t numb, const ProcessorOptions& options);
 	~Tile();
 	Mux *treeLeaf;
 	Processor *tileProcessor;
@@ -37,6 +40,15 @@ public:
     	void writeByte(const uint64_t& address, const uint8_t& value) const;
    	 void writeLong(const uint64_t& address, const uint64_t& value) const;
 	ControlThread *getBarrier();
+	bool isDeterministic() const;
+	const std::vector<std::pair<long, long> >& getConnections() const
+		{ return connections; }
+	//read-only sharing pass through
+	void shareLines(const uint64_t page, const uint64_t firstLine,
+		const uint64_t lines, const uint64_t linesPerPage);
+	void unsharePage(const uint64_t page);
+	long findSharer(const uint64_t page, const uint64_t firstLine,
+		const uint64_t lines, const uint64_t maxHops);
 };
 
 #endif
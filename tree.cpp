@@ -77,9 +77,21 @@ Tree::Tree(Memory& globalMemory, Noc& noc, const long columns, const long rows)
 	for (unsigned int i = 0; i < nodesTree.size(); i++) {
 		for (unsigned int j = 0; j < nodesTree[i].size(); j++) {
 			nodesTree[i][j].initialiseMutex();
+			nodesTree[i][j].setDeterministic(noc.isDeterministic());
 		}
 	}
 
 	//attach root to global memory
 	globalMemory.attachTree(&(nodesTree.at(nodesTree.size() - 1)[0]));
 }
+
+//root first, so buffers freed higher up can be taken from below on the
+//same tick
+void Tree::arbitrate()
+{
+	for (long i = levels; i >= 0; i--) {
+		for (unsigned int j = 0; j < nodesTree[i].size(); j++) {
+			nodesTree[i][j].arbitrate();
+		}
+	}
+}
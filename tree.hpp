@@ -15,5 +15,6 @@ private:
 public:
 	Tree(Memory& globalMemory, Noc& noc,
 		const long columns, const long rows);
+	void arbitrate();
 };
 #endif
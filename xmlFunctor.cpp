@@ -12,6 +12,7 @@
 #include <xercesc/sax2/XMLReaderFactory.hpp>
 #include <xercesc/sax2/DefaultHandler.hpp>
 #include <xercesc/util/XMLString.hpp>
+#include <xercesc/framework/XMLPScanToken.hpp>
 #include <unistd.h>
 #include "mainwindow.h"
 #include "ControlThread.hpp"
@@ -48,23 +49,36 @@ void XMLFunctor::operator()()
     }
     proc->start();
 
-    uint64_t pass = 0;
+    //each context replays its own trace, time-sliced on this processor
+    const uint64_t contexts = proc->contextCount();
+    vector<SAX2XMLReader *> parsers(contexts, nullptr);
+    vector<SAX2Handler *> handlers(contexts, nullptr);
+    vector<XMLPScanToken> tokens(contexts);
+    vector<uint64_t> passes(contexts, 0);
+    vector<string> traces(contexts);
+    auto startTrace = [&](const uint64_t& context) {
+  	traces[context] = string("lackeyml_") +
+            to_string((order + context) % 8);
+    	parsers[context] = XMLReaderFactory::createXMLReader();
+    	parsers[context]->setFeature(XMLUni::fgSAX2CoreValidation, true);
+    	parsers[context]->setFeature(XMLUni::fgSAX2CoreNameSpaces, true);
+    	handlers[context] = new SAX2Handler();
+    	parsers[context]->setContentHandler(handlers[context]);
+    	parsers[context]->setErrorHandler(handlers[context]);
+    	handlers[context]->setMemoryHandler(this);
+    	parsers[context]->parseFirst(traces[context].c_str(),
+            tokens[context]);
+    };
+    for (uint64_t i = 0; i < contexts; i++) {
+        startTrace(i);
+    }
 
+    uint64_t current = 0;
+    uint64_t sliceStart = proc->getTicks();
     while (true) {
-  	string lackeyml("lackeyml_");
-    	lackeyml += to_string(tile->getOrder()%8);
-
-    	SAX2XMLReader *parser = XMLReaderFactory::createXMLReader();
-    	parser->setFeature(XMLUni::fgSAX2CoreValidation, true);
-    	parser->setFeature(XMLUni::fgSAX2CoreNameSpaces, true);
-
-    	SAX2Handler *lackeyHandler = new SAX2Handler();
-    	parser->setContentHandler(lackeyHandler);
-    	parser->setErrorHandler(lackeyHandler);
-    	lackeyHandler->setMemoryHandler(this);
-
+        bool more = false;
     	try {
-        	parser->parse(lackeyml.c_str());
+        	more = parsers[current]->parseNext(tokens[current]);
     	}
     	catch (const SAXParseException& toCatch) {
            char* message = XMLString::transcode(toCatch.getMessage());
@@ -72,20 +86,108 @@ void XMLFunctor::operator()()
                 << message << "\n";
            XMLString::release(&message);
            exit(1);
-    }
-    	cout << "===========" << endl;
-    	cout << "On pass " << pass << endl;
-    	cout << "Task on " << order << " completed." << endl;
-   	cout << "Hard fault count: " << proc->hardFaultCount << endl;
-    	cout << "Small fault count: " << proc->smallFaultCount << endl;
-    	cout << "Blocks: " << proc->blocks << endl;
-    	cout << "Service time: " << proc->serviceTime << endl;
-    	cout << "Ticks: " << proc->getTicks() << endl;
-    	cout << "===========" << endl;
-    	proc->resetCounters();
-    	pass++;
-    	delete lackeyHandler;
-	delete parser;
+    	}
+        if (!more) {
+        	proc->fence();
+        	cout << "===========" << endl;
+        	cout << "On pass " << passes[current] << endl;
+        	cout << "Task on " << order << " completed." << endl;
+        	//faults are this context's over its pass - the counters
+        	//below are the tile's since any context last finished
+        	uint64_t hardFaults = proc->hardFaultCount;
+        	uint64_t smallFaults = proc->smallFaultCount;
+        	if (contexts > 1) {
+            	proc->accountContext();
+            	ContextStats& stats = proc->contextStats[current];
+            	cout << "Context " << current << " (" << traces[current];
+            	cout << ") ticks: " << stats.ticks;
+            	cout << " switches: " << stats.switches << endl;
+            	hardFaults = stats.hardFaults;
+            	smallFaults = stats.smallFaults;
+            	stats = ContextStats();
+        	}
+        	cout << "Hard fault count: " << hardFaults << endl;
+        	cout << "Small fault count: " << smallFaults << endl;
+        	cout << "Blocks: " << proc->blocks << endl;
+        	cout << "Service time: " << proc->serviceTime << endl;
+        	cout << "Dirty lines written back: " << proc->dirtyLinesWritten << endl;
+        	cout << "Clean lines skipped: " << proc->cleanLinesSkipped << endl;
+        	cout << "Write-back bursts: " << proc->burstsWritten << endl;
+        	cout << "Lines fetched: " << proc->linesFetched << endl;
+        	cout << "Fetch widenings: " << proc->fetchWidenings;
+        	cout << " narrowings: " << proc->fetchNarrowings << endl;
+        	cout << "Lines cleaned: " << proc->linesCleaned;
+        	cout << " clean victims: " << proc->cleanVictims << endl;
+        	if (proc->mshrSamples > 0) {
+            	cout << "MSHR occupancy: " << static_cast<double>(
+                	proc->mshrOccupancy) / proc->mshrSamples;
+            	cout << " peak: " << proc->mshrPeak;
+            	cout << " merges: " << proc->mshrMerges;
+            	cout << " full stalls: " << proc->mshrFullStalls << endl;
+        	}
+        	cout << "Stores buffered: " << proc->storesBuffered;
+        	cout << " merged: " << proc->storesMerged;
+        	cout << " forwarded: " << proc->storeForwards;
+        	cout << " retired idle: " << proc->storesRetiredIdle;
+        	cout << " drains: " << proc->storeDrains << endl;
+        	cout << "Stream buffer hits: " << proc->streamHits;
+        	cout << " misses: " << proc->streamMisses;
+        	if (proc->streamHits + proc->streamMisses > 0) {
+            	cout << " hit rate: " << (100 * proc->streamHits) /
+                	(proc->streamHits + proc->streamMisses) << "%";
+        	}
+        	cout << " late: " << proc->streamLate;
+        	cout << " flushes: " << proc->streamFlushes << endl;
+        	cout << "Handler ticks: " << proc->handlerTicks;
+        	cout << " register save ticks: " << proc->saveTicks << endl;
+        	cout << "Page table walks: " << proc->tableWalks;
+        	cout << " probes: " << proc->walkProbes;
+        	cout << " scans: " << proc->walkFallbacks << endl;
+        	cout << "Prefetched lines: " << proc->prefetchLines;
+        	cout << " used: " << proc->prefetchHits;
+        	cout << " demand misses: " << proc->demandMisses << endl;
+        	if (proc->prefetchLines > 0) {
+            	cout << "Prefetch accuracy: ";
+            	cout << (100 * proc->prefetchHits) / proc->prefetchLines;
+            	cout << "% coverage: " << (100 * proc->prefetchHits) /
+                	(proc->prefetchHits + proc->demandMisses) << "%" << endl;
+        	}
+        	cout << "Pinned frames: " << proc->pinnedFrames;
+        	cout << " refused: " << proc->pinsRefused << endl;
+        	if (proc->meshQueries > 0) {
+            	cout << "Mesh queries: " << proc->meshQueries;
+            	cout << " hits: " << proc->meshHits;
+            	cout << " hit rate: " <<
+                	(100 * proc->meshHits) / proc->meshQueries << "%";
+            	if (proc->meshHits > 0) {
+                	cout << " mean hops: " << static_cast<double>(
+                    	proc->meshHops) / proc->meshHits;
+            	}
+            	cout << endl;
+        	}
+        	if (proc->aheadWindows > 0) {
+            	cout << "Run-ahead windows: " << proc->aheadWindows;
+            	cout << " ticks: " << proc->aheadTicks;
+            	cout << " deepest: " << proc->aheadDeepest;
+            	cout << " mean depth: " << static_cast<double>(
+                	proc->aheadDepth) / proc->aheadSamples << endl;
+        	}
+        	cout << "Context switches: " << proc->contextSwitches;
+        	cout << " TLB flushes: " << proc->tlbFlushes << endl;
+        	cout << "Ticks: " << proc->getTicks() << endl;
+        	cout << "===========" << endl;
+        	proc->resetCounters();
+        	passes[current]++;
+        	delete handlers[current];
+        	delete parsers[current];
+        	startTrace(current);
+        }
+        //end of quantum - next context
+        if (contexts > 1 &&
+            proc->getTicks() - sliceStart >= CONTEXT_QUANTUM) {
+            current = (current + 1) % contexts;
+            proc->switchContext(current);
+            sliceStart = proc->getTicks();
+        }
     } //off we go again
-    proc->getTile()->getBarrier()->decrementTaskCount();
 }